@@ -20,12 +20,24 @@
 #include "adminmedia.h"
 
 #include <Cutelyst/Upload>
+#include <Cutelyst/Plugins/Utils/Pagination>
+#include <Cutelyst/Plugins/StatusMessage>
 
 #include <QDir>
-#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
 #include <QStringBuilder>
 #include <QDebug>
 
+#include "libCMS/engine.h"
+#include "libCMS/mediastore.h"
+#include "libCMS/jobscheduler.h"
+
+static CMS::MediaStore mediaStore(Context *c)
+{
+    return CMS::MediaStore(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/media"));
+}
+
 AdminMedia::AdminMedia(QObject *app) : Controller(app)
 {
 
@@ -38,77 +50,57 @@ AdminMedia::~AdminMedia()
 
 void AdminMedia::index(Context *c)
 {
-    const static QDir mediaDir(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/media"));
-
-    QStringList files;
-    QDirIterator it(mediaDir.absolutePath(),
-                    QDir::Files | QDir::NoDotAndDotDot,
-                    QDirIterator::Subdirectories);
-    while (it.hasNext()) {
-        files.append(it.next());
-    }
-    files.sort(Qt::CaseInsensitive);
-
-    int removeSize = mediaDir.absolutePath().size();
-    QVariantList filesHash;
-    for (const QString &file : files) {
-        QFileInfo fileInfo(file);
-
-        QString id = file.mid(removeSize);
-
-        QString urlPath = QLatin1String("/.media") + id;
-
-        QVariantHash hash;
-        hash.insert(QStringLiteral("id"), id);
-        hash.insert(QStringLiteral("name"), fileInfo.fileName());
-        hash.insert(QStringLiteral("modified"), fileInfo.lastModified());
-        hash.insert(QStringLiteral("url"), c->uriFor(urlPath).toString());
-        filesHash.push_back(hash);
+    CMS::MediaStore store = mediaStore(c);
+
+    const QString search = c->req()->queryParam(QStringLiteral("search"));
+    Pagination pagination(store.count(search),
+                          50,
+                          c->req()->queryParam(QStringLiteral("page"), QStringLiteral("1")).toInt());
+
+    QVariantList files = store.list(search, pagination.offset(), pagination.limit());
+    for (QVariant &file : files) {
+        QVariantHash hash = file.toHash();
+        hash.insert(QStringLiteral("id"), hash.value(QStringLiteral("name")));
+        hash.insert(QStringLiteral("url"), c->uriFor(hash.value(QStringLiteral("url")).toString()).toString());
+        file = hash;
     }
 
     c->stash({
                    {QStringLiteral("template"), QStringLiteral("media/index.html")},
-                   {QStringLiteral("files"), filesHash}
+                   {QStringLiteral("files"), files},
+                   {QStringLiteral("search"), search},
+                   {QStringLiteral("pagination"), pagination}
                });
 }
 
 void AdminMedia::upload(Context *c)
 {
-    const static QDir mediaDir(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/media"));
+    CMS::MediaStore store = mediaStore(c);
 
-    if (!mediaDir.exists() && !mediaDir.mkpath(mediaDir.absolutePath())) {
-        qWarning() << "Could not create media directory" << mediaDir.absolutePath();
-        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("index")),
-                                              ParamsMultiMap({
-                                                                 {QStringLiteral("error_msg"), QStringLiteral("Failed to save file")}
-                                                             })));
-        return;
-    }
+    // Limits per top level mime type
+    const QHash<QString, qint64> maxSizes = {
+        {QStringLiteral("image"), c->config(QStringLiteral("MediaMaxSizeImage"), 20971520).toLongLong()},
+        {QStringLiteral("video"), c->config(QStringLiteral("MediaMaxSizeVideo"), Q_INT64_C(1073741824)).toLongLong()},
+        {QStringLiteral("audio"), c->config(QStringLiteral("MediaMaxSizeAudio"), 104857600).toLongLong()},
+        {QStringLiteral("*"), c->config(QStringLiteral("MediaMaxSize"), 67108864).toLongLong()},
+    };
 
-    // TODO this is NOT working...
-    QFile link(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/.media"));
-    if (!link.exists() && !QFile::link(QStringLiteral("media"), link.fileName())) {
-        qWarning() << "Could not create link media directory" << mediaDir.absolutePath() << link.fileName();
-        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("index")),
-                                              ParamsMultiMap({
-                                                                 {QStringLiteral("error_msg"), QStringLiteral("Failed to save file")}
-                                                             })));
-        return;
+    // Refuse what can't fit before looking at the body
+    Request *request = c->request();
+    qint64 largest = 0;
+    for (qint64 maxSize : maxSizes) {
+        largest = qMax(largest, maxSize);
     }
-
-    QDir fileDir(mediaDir.absolutePath() + QDateTime::currentDateTimeUtc().toString(QStringLiteral("/yyyy/MM")));
-    if (!fileDir.exists() && !fileDir.mkpath(fileDir.absolutePath())) {
-        qWarning() << "Could not create media directory" << fileDir.absolutePath();
+    if (request->headers().contentLength() > largest) {
         c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("index")),
                                               ParamsMultiMap({
-                                                                 {QStringLiteral("error_msg"), QStringLiteral("Failed to save file")}
+                                                                 {QStringLiteral("error_msg"), QStringLiteral("File is too large")}
                                                              })));
         return;
     }
 
-    Request *request = c->request();
     Upload *upload = request->upload(QStringLiteral("file"));
-    if (!upload) {
+    if (!upload || !upload->open(QIODevice::ReadOnly)) {
         qWarning() << "Could not find upload";
         c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("index")),
                                               ParamsMultiMap({
@@ -117,12 +109,14 @@ void AdminMedia::upload(Context *c)
         return;
     }
 
-    QString filepath = fileDir.absoluteFilePath(upload->filename());
-    if (!upload->save(filepath)) {
-        qWarning() << "Could not save upload" << filepath;
+    const QString name = QDateTime::currentDateTimeUtc().toString(QStringLiteral("yyyy/MM/")) + QFileInfo(upload->filename()).fileName();
+    if (store.add(upload, name, maxSizes).isEmpty()) {
+        qWarning() << "Could not save upload" << name << store.errorString();
         c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("index")),
                                               ParamsMultiMap({
-                                                                 {QStringLiteral("error_msg"), QStringLiteral("Failed to save file")}
+                                                                 {QStringLiteral("error_msg"),
+                                                                  store.error() == CMS::MediaStore::TooLarge ?
+                                                                  QStringLiteral("File is too large") : QStringLiteral("Failed to save file")}
                                                              })));
         return;
     }
@@ -132,8 +126,6 @@ void AdminMedia::upload(Context *c)
 
 void AdminMedia::remove(Context *c, const QStringList &path)
 {
-    const static QDir mediaDir(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/media"));
-
     QString file;
 
     for (const QString &part : path) {
@@ -148,11 +140,25 @@ void AdminMedia::remove(Context *c, const QStringList &path)
         }
     }
 
-    QFile removeFile(mediaDir.absoluteFilePath(file));
-    if (!removeFile.remove()) {
-        qDebug() << "Failed to remove media file" << removeFile.fileName() << removeFile.errorString();
+    CMS::MediaStore store = mediaStore(c);
+    if (!store.remove(file)) {
+        qDebug() << "Failed to remove media file" << file << store.errorString();
     }
 
     c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("index"))));
 }
 
+void AdminMedia::reconcile(Context *c)
+{
+    if (!c->req()->isPost()) {
+        c->res()->setStatus(Response::MethodNotAllowed);
+        return;
+    }
+
+    // Walking and hashing the whole directory is done by the job workers
+    const QString msg = CMS::JobScheduler::enqueue(QStringLiteral("media-reconcile"), QJsonObject(), 0, QDateTime(), QStringLiteral("media-reconcile")) ?
+                QStringLiteral("Reconcile started, the results are logged when it finishes.") :
+                QStringLiteral("Failed to start reconcile.");
+    c->res()->redirect(c->uriFor(CActionFor(QStringLiteral("index")),
+                                 StatusMessage::statusQuery(c, msg)));
+}
@@ -41,6 +41,9 @@ public:
 
     C_ATTR(remove, :Local :AutoArgs)
     void remove(Context *c, const QStringList &path);
+
+    C_ATTR(reconcile, :Local :AutoArgs)
+    void reconcile(Context *c);
 };
 
 #endif // ADMINMEDIA_H
@@ -25,6 +25,8 @@
 #include <QDebug>
 
 #include "libCMS/page.h"
+#include "libCMS/textdelta.h"
+#include "libCMS/markdown.h"
 
 AdminPages::AdminPages(Application *app) : Controller(app)
 {
@@ -51,6 +53,11 @@ void AdminPages::edit(Context *c, const QString &id)
     edit(c, id, QStringLiteral("page"), true);
 }
 
+void AdminPages::revisions(Context *c, const QString &id)
+{
+    revisions(c, id, QStringLiteral("page"), true);
+}
+
 void AdminPages::remove(Context *c, const QString &id)
 {
     if (!c->request()->isPost()) {
@@ -83,6 +90,11 @@ void AdminPages::create(Context *c, const QString &postType, bool isPage)
     QString title = params.value(QStringLiteral("title"));
     QString path = params.value(QStringLiteral("path"));
     QString content = params.value(QStringLiteral("edit-content"));
+    // Picked before the editor loads, it can't switch a typed text
+    QString format = c->req()->isPost() ? params.value(QStringLiteral("format")) : c->req()->queryParam(QStringLiteral("format"));
+    if (format != QLatin1String("markdown") || !CMS::Markdown::isAvailable()) {
+        format.clear();
+    }
     if (c->req()->isPost()) {
         QString savePath;
         if (isPage) {
@@ -99,7 +111,8 @@ void AdminPages::create(Context *c, const QString &postType, bool isPage)
         auto page = new CMS::Page(c);
         page->setPath(savePath);
         page->setUuid(QString());
-        page->setContent(content, true);
+        page->setFormat(format);
+        page->setSource(content);
         page->setTitle(title);
         page->setPage(isPage);
 
@@ -127,6 +140,8 @@ void AdminPages::create(Context *c, const QString &postType, bool isPage)
     c->setStash(QStringLiteral("title"), title);
     c->setStash(QStringLiteral("path"), path);
     c->setStash(QStringLiteral("edit_content"), content);
+    c->setStash(QStringLiteral("format"), format);
+    c->setStash(QStringLiteral("markdown_available"), CMS::Markdown::isAvailable());
     c->setStash(QStringLiteral("template"), QStringLiteral("posts/create.html"));
 }
 
@@ -140,7 +155,7 @@ void AdminPages::edit(Context *c, const QString &id, const QString &postType, bo
 
     QString path = page->path();
     QString title = page->title();
-    QString content = page->content();
+    QString content = page->source();
 
     if (c->req()->isPost()) {
         const ParamsMultiMap params = c->request()->bodyParams();
@@ -149,17 +164,30 @@ void AdminPages::edit(Context *c, const QString &id, const QString &postType, bo
         path = params.value(QStringLiteral("path"));
         QString action = params.value(QStringLiteral("submit"));
 
-        page->updateContent(content);
+        page->setSource(content);
         page->setTitle(title);
         page->setPage(isPage);
         page->setPath(path);
         if (action == QLatin1String("unpublish")) {
             page->setPublished(false);
+            page->setScheduled(false);
         } else if (action == QLatin1String("publish")) {
             page->setPublished(true);
-            if (!page->publishedAt().isValid()) {
+            if (!page->publishedAt().isValid() || page->scheduled()) {
                 page->setPublishedAt(QDateTime::currentDateTimeUtc());
             }
+            page->setScheduled(false);
+        } else if (action == QLatin1String("schedule")) {
+            // Entered in the site time zone
+            QDateTime publishAt = QDateTime::fromString(params.value(QStringLiteral("publish_at")), QStringLiteral("yyyy-MM-ddTHH:mm"));
+            if (publishAt.isValid()) {
+                publishAt.setTimeZone(engine->timeZone());
+                page->setPublished(false);
+                page->setScheduled(true);
+                page->setPublishedAt(publishAt.toUTC());
+            } else {
+                c->setStash(QStringLiteral("error_msg"), QStringLiteral("Invalid publish date"));
+            }
         }
         page->setUpdated(QDateTime::currentDateTimeUtc());
 
@@ -175,8 +203,59 @@ void AdminPages::edit(Context *c, const QString &id, const QString &postType, bo
     c->setStash(QStringLiteral("title"), title);
     c->setStash(QStringLiteral("path"), path);
     c->setStash(QStringLiteral("edit_content"), content);
+    c->setStash(QStringLiteral("format"), page->format());
     c->setStash(QStringLiteral("editting"), true);
+    c->setStash(QStringLiteral("id"), page->id());
     c->setStash(QStringLiteral("published"), page->published());
+    c->setStash(QStringLiteral("scheduled"), page->scheduled());
+    c->setStash(QStringLiteral("publish_at"), page->publishedAt());
     c->setStash(QStringLiteral("post_type"), postType);
     c->setStash(QStringLiteral("template"), QStringLiteral("posts/create.html"));
 }
+
+void AdminPages::revisions(Context *c, const QString &id, const QString &postType, bool isPage)
+{
+    CMS::Page *page = engine->getPageById(id, c);
+    if (!page || page->page() != isPage) {
+        c->res()->redirect(c->uriFor(actionFor(QStringLiteral("index"))));
+        return;
+    }
+
+    // Restoring saves the old text as a new revision
+    if (c->req()->isPost()) {
+        QString title;
+        QString content;
+        if (engine->revision(page->id(), c->req()->bodyParam(QStringLiteral("restore")).toInt(), &title, &content)) {
+            page->setTitle(title);
+            page->setSource(content);
+            page->setUpdated(QDateTime::currentDateTimeUtc());
+            page->setAuthor(engine->user(Authentication::user(c).id().toInt()));
+            if (engine->savePage(c, page)) {
+                c->res()->redirect(c->uriFor(actionFor(QStringLiteral("edit")), QStringList{ id }));
+                return;
+            }
+        }
+        c->setStash(QStringLiteral("error_msg"), QStringLiteral("Failed to restore revision"));
+    }
+
+    const int diff = c->req()->queryParam(QStringLiteral("diff")).toInt();
+    if (diff > 0) {
+        QString title;
+        QString content;
+        QString previousTitle;
+        QString previous;
+        if (engine->revision(page->id(), diff, &title, &content)) {
+            if (diff > 1) {
+                engine->revision(page->id(), diff - 1, &previousTitle, &previous);
+            }
+            c->setStash(QStringLiteral("diff"), CMS::TextDelta::lineDiff(previous, content));
+            c->setStash(QStringLiteral("diff_revision"), diff);
+        }
+    }
+
+    c->setStash(QStringLiteral("id"), page->id());
+    c->setStash(QStringLiteral("title"), page->title());
+    c->setStash(QStringLiteral("revisions"), engine->revisions(page->id()));
+    c->setStash(QStringLiteral("post_type"), postType);
+    c->setStash(QStringLiteral("template"), QStringLiteral("posts/revisions.html"));
+}
@@ -47,10 +47,14 @@ public:
     C_ATTR(remove, :Path('delete') :AutoArgs)
     void remove(Context *c, const QString &id);
 
+    C_ATTR(revisions, :Local :AutoArgs)
+    virtual void revisions(Context *c, const QString &id);
+
 protected:
     void index(Context *c, const QString &postType, CMS::Engine::Filter filters);
     void create(Context *c, const QString &postType, bool isPage);
     void edit(Context *c, const QString &id, const QString &postType, bool isPage);
+    void revisions(Context *c, const QString &id, const QString &postType, bool isPage);
 };
 
 #endif // ADMINPAGES_H
@@ -46,3 +46,8 @@ void AdminPosts::edit(Context *c, const QString &id)
 {
     AdminPages::edit(c, id, QStringLiteral("post"), false);
 }
+
+void AdminPosts::revisions(Context *c, const QString &id)
+{
+    AdminPages::revisions(c, id, QStringLiteral("post"), false);
+}
@@ -39,6 +39,8 @@ public:
     virtual void create(Context *c) override;
 
     virtual void edit(Context *c, const QString &id) override;
+
+    virtual void revisions(Context *c, const QString &id) override;
 };
 
 #endif // ADMINPOSTS_H
@@ -20,6 +20,11 @@
 #include "adminsettings.h"
 
 #include "libCMS/page.h"
+#include "libCMS/contentcodec.h"
+#include "libCMS/jobscheduler.h"
+
+#include "gzipwriter.h"
+#include "staticexporter.h"
 
 #include <Cutelyst/Application>
 #include <Cutelyst/Upload>
@@ -38,8 +43,13 @@
 #include <QSqlError>
 
 #include <QDir>
+#include <QFileInfo>
 #include <QDebug>
 
+#include <functional>
+
+#define JSON_EXPORT_CHUNK 65536
+
 AdminSettings::AdminSettings(Application *app) : Controller(app)
 {
 
@@ -71,7 +81,7 @@ void AdminSettings::general(Context *c)
         timezones.push_back(QString::fromUtf8(rawTz));
     }
 
-    QDir themesDir = c->app()->pathTo(QStringLiteral("root/themes"));
+    QDir themesDir = c->app()->config(QStringLiteral("ThemesPath"), c->app()->pathTo(QStringLiteral("root/themes"))).toString();
     QStringList themes = themesDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot,
                                              QDir::Name | QDir:: IgnoreCase);
 
@@ -271,6 +281,11 @@ void AdminSettings::users_delete(Context *c, const QString &id)
 
 void AdminSettings::database(Context *c)
 {
+    const QStringList backups = backupsDir(c).entryList({ QStringLiteral("*.sqlite"), QStringLiteral("*.sqlite.gz") },
+                                                        QDir::Files,
+                                                        QDir::Name | QDir::Reversed);
+    c->setStash(QStringLiteral("backups"), backups);
+    c->setStash(QStringLiteral("static_output"), staticOutput(c));
     c->setStash(QStringLiteral("users"), engine->users());
     c->setStash(QStringLiteral("template"), QStringLiteral("settings/database.html"));
 }
@@ -362,7 +377,14 @@ void AdminSettings::json_import(Context *c)
             Author author;
             author.insert(QStringLiteral("id"), QString::number(post.value(QLatin1String("author_id")).toInt()));
             page->setAuthor(author);
-            page->setContent(post.value(QStringLiteral("content")).toString(), true);
+            if (post.value(QStringLiteral("format")).toString() == QLatin1String("markdown") ||
+                    (!post.contains(QStringLiteral("content")) && post.contains(QStringLiteral("markdown")))) {
+                // Ghost compatibility
+                page->setFormat(QStringLiteral("markdown"));
+                page->setSource(post.value(post.contains(QStringLiteral("content")) ? QStringLiteral("content") : QStringLiteral("markdown")).toString());
+            } else {
+                page->setContent(post.value(QStringLiteral("content")).toString(), true);
+            }
             page->setTitle(post.value(QStringLiteral("title")).toString());
             page->setUuid(post.value(QStringLiteral("uuid")).toString());
             if (post.contains(QStringLiteral("path"))) {
@@ -399,96 +421,157 @@ void AdminSettings::json_import(Context *c)
 
 void AdminSettings::json_export(Context *c)
 {
-    QJsonObject data;
-
     const ParamsMultiMap params = c->request()->queryParams();
+    const bool gzip = params.contains(QStringLiteral("gzip"));
+
+    Response *res = c->response();
+    Headers &headers = res->headers();
+    const QString filename = QStringLiteral("data.cmlyst.%1.json")
+            .arg(QDateTime::currentDateTimeUtc().toString(QStringLiteral("yyyy-MM-dd")));
+    if (gzip) {
+        headers.setContentType(QStringLiteral("application/gzip"));
+        headers.setContentDispositionAttachment(filename + QLatin1String(".gz"));
+    } else {
+        headers.setContentType(QStringLiteral("application/json"));
+        headers.setContentDispositionAttachment(filename);
+    }
 
-    QSqlQuery query;
+    // Rows are serialized one by one and written out whenever the
+    // buffer gets full, the response is then sent chunked so that
+    // memory usage doesn't depend on the database size
+    QByteArray buffer;
+    buffer.reserve(JSON_EXPORT_CHUNK);
+    GzipWriter gzipWriter(res);
+    auto flush = [&] () {
+        if (gzip) {
+            gzipWriter.write(buffer);
+        } else {
+            res->write(buffer);
+        }
+        buffer.clear();
+    };
+    auto write = [&] (const QByteArray &data) {
+        buffer.append(data);
+        if (buffer.size() >= JSON_EXPORT_CHUNK) {
+            flush();
+        }
+    };
+    auto writeArray = [&] (QSqlQuery &query, std::function<QJsonObject(const QSqlQuery &)> toObject) {
+        bool first = true;
+        write(QByteArrayLiteral("["));
+        while (query.next()) {
+            if (!first) {
+                write(QByteArrayLiteral(","));
+            }
+            first = false;
+            write(QJsonDocument(toObject(query)).toJson(QJsonDocument::Compact));
+        }
+        write(QByteArrayLiteral("]"));
+    };
+
+    bool first = true;
+    auto writeKey = [&] (const QByteArray &key) {
+        if (!first) {
+            write(QByteArrayLiteral(","));
+        }
+        first = false;
+        write('"' + key + QByteArrayLiteral("\":"));
+    };
+
+    write(QByteArrayLiteral("{\"db\":[{\"data\":{"));
 
     if (params.contains(QStringLiteral("posts"))) {
-        query = CPreparedSqlQueryThreadForDB(
-                    QStringLiteral("SELECT id, name, path, content, html, blog, author, created, modified "
-                                   "FROM pages "
+        QSqlQuery query = CPreparedSqlQueryThreadForDB(
+                    QStringLiteral("SELECT id, uuid, path, title, content, html, page, published, allow_comments, "
+                                   "author_id, created_at, updated_at, published_at, content_z, format "
+                                   "FROM posts "
                                    ),
                     QStringLiteral("cmlyst"));
+        query.setForwardOnly(true);
         if (query.exec()) {
-            QJsonArray posts;
-            while (query.next()) {
+            writeKey(QByteArrayLiteral("posts"));
+            writeArray(query, [] (const QSqlQuery &query) {
                 QJsonObject post;
-                post.insert(QStringLiteral("id"), query.value(QStringLiteral("id")).toLongLong());
-                post.insert(QStringLiteral("title"), query.value(QStringLiteral("name")).toString());
-                const QString path = query.value(QStringLiteral("path")).toString();
+                post.insert(QStringLiteral("id"), query.value(0).toLongLong());
+                post.insert(QStringLiteral("uuid"), query.value(1).toString());
+                const QString path = query.value(2).toString();
                 if (path.isEmpty()) {
                     post.insert(QStringLiteral("slug"), QStringLiteral("index-slug"));
                 } else {
                     post.insert(QStringLiteral("slug"), path);
                 }
                 post.insert(QStringLiteral("path"), path);
-                post.insert(QStringLiteral("content"), query.value(QStringLiteral("content")).toString());
-                post.insert(QStringLiteral("html"), query.value(QStringLiteral("html")).toString());
-                post.insert(QStringLiteral("page"), !query.value(QStringLiteral("blog")).toBool());
-                post.insert(QStringLiteral("author_id"), query.value(QStringLiteral("author")).toLongLong());
-                const QDateTime modified = QDateTime::fromMSecsSinceEpoch(query.value(QStringLiteral("modified")).toLongLong() * 1000, Qt::UTC);
-                post.insert(QStringLiteral("created_at"), modified.toString(QStringLiteral("yyyy-MM-dd HH:mm:ss")));
-                post.insert(QStringLiteral("updated_at"), modified.toString(QStringLiteral("yyyy-MM-dd HH:mm:ss")));
-                const QDateTime created = QDateTime::fromMSecsSinceEpoch(query.value(QStringLiteral("created")).toLongLong() * 1000, Qt::UTC);
-                post.insert(QStringLiteral("published_at"), created.toString(QStringLiteral("yyyy-MM-dd HH:mm:ss")));
-
-                posts.append(post);
-            }
-            data.insert(QStringLiteral("posts"), posts);
+                post.insert(QStringLiteral("title"), query.value(3).toString());
+                const QString content = CMS::ContentCodec::content(query.value(4), query.value(13));
+                post.insert(QStringLiteral("content"), content);
+                post.insert(QStringLiteral("html"), query.value(5).isNull() ? content : query.value(5).toString());
+                if (query.value(14).toString() == QLatin1String("markdown")) {
+                    // Ghost compatibility
+                    post.insert(QStringLiteral("markdown"), content);
+                    post.insert(QStringLiteral("format"), query.value(14).toString());
+                }
+                post.insert(QStringLiteral("page"), query.value(6).toBool());
+                post.insert(QStringLiteral("published"), query.value(7).toBool());
+                post.insert(QStringLiteral("allow_comments"), query.value(8).toBool());
+                post.insert(QStringLiteral("author_id"), query.value(9).toLongLong());
+                post.insert(QStringLiteral("created_at"), CMS::Engine::toSqlDateTime(CMS::Engine::fromSqlDateTime(query.value(10))).toString());
+                post.insert(QStringLiteral("updated_at"), CMS::Engine::toSqlDateTime(CMS::Engine::fromSqlDateTime(query.value(11))).toString());
+                post.insert(QStringLiteral("published_at"), CMS::Engine::toSqlDateTime(CMS::Engine::fromSqlDateTime(query.value(12))).toString());
+                return post;
+            });
+        } else {
+            qWarning() << "Failed to export posts" << query.lastError().databaseText();
         }
     }
 
     if (params.contains(QStringLiteral("users"))) {
-        query = CPreparedSqlQueryThreadForDB(
+        QSqlQuery query = CPreparedSqlQueryThreadForDB(
                     QStringLiteral("SELECT id, slug, email, password, json "
                                    "FROM users "
                                    ),
                     QStringLiteral("cmlyst"));
+        query.setForwardOnly(true);
         if (query.exec()) {
-            QJsonArray users;
-            while (query.next()) {
-                QJsonDocument doc = QJsonDocument::fromJson(query.value(QStringLiteral("json")).toString().toUtf8());
+            writeKey(QByteArrayLiteral("users"));
+            writeArray(query, [] (const QSqlQuery &query) {
+                QJsonDocument doc = QJsonDocument::fromJson(query.value(4).toString().toUtf8());
                 QJsonObject user = doc.object();
-                user.insert(QStringLiteral("id"), query.value(QStringLiteral("id")).toLongLong());
-                user.insert(QStringLiteral("slug"), query.value(QStringLiteral("slug")).toString());
-                user.insert(QStringLiteral("email"), query.value(QStringLiteral("email")).toString());
-                user.insert(QStringLiteral("password"), query.value(QStringLiteral("password")).toString());
-
-                users.append(user);
-            }
-            data.insert(QStringLiteral("users"), users);
+                user.insert(QStringLiteral("id"), query.value(0).toLongLong());
+                user.insert(QStringLiteral("slug"), query.value(1).toString());
+                user.insert(QStringLiteral("email"), query.value(2).toString());
+                user.insert(QStringLiteral("password"), query.value(3).toString());
+                return user;
+            });
+        } else {
+            qWarning() << "Failed to export users" << query.lastError().databaseText();
         }
     }
 
     if (params.contains(QStringLiteral("settings"))) {
-        QJsonArray settingsArray;
-        auto settings = engine->settings();
+        writeKey(QByteArrayLiteral("settings"));
+        write(QByteArrayLiteral("["));
+        const auto settings = engine->settings();
         auto settingsIt = settings.constBegin();
         while (settingsIt != settings.constEnd()) {
+            if (settingsIt != settings.constBegin()) {
+                write(QByteArrayLiteral(","));
+            }
             QJsonObject pair;
             pair.insert(QStringLiteral("key"), settingsIt.key());
             pair.insert(QStringLiteral("value"), settingsIt.value());
-            settingsArray.append(pair);
+            write(QJsonDocument(pair).toJson(QJsonDocument::Compact));
 
             ++settingsIt;
         }
-        data.insert(QStringLiteral("settings"), settingsArray);
+        write(QByteArrayLiteral("]"));
     }
 
-    QJsonObject dbObject;
-    dbObject.insert(QStringLiteral("data"), data);
+    write(QByteArrayLiteral("}}]}"));
+    flush();
 
-    QJsonArray dbArray;
-    dbArray.append(dbObject);
-
-    QJsonObject main;
-    main.insert(QStringLiteral("db"), dbArray);
-
-    c->response()->setJsonBody(QJsonDocument(main));
-    c->response()->headers().setContentDispositionAttachment(QStringLiteral("data.cmlyst.%1.json")
-                                                             .arg(QDateTime::currentDateTimeUtc().toString(QStringLiteral("yyyy-MM-dd"))));
+    if (gzip) {
+        gzipWriter.finish();
+    }
 }
 
 void AdminSettings::db_clean(Context *c)
@@ -509,3 +592,108 @@ void AdminSettings::db_clean(Context *c)
                                                                     .arg(query.lastError().databaseText()))));
     }
 }
+
+void AdminSettings::backup(Context *c)
+{
+    if (!c->request()->isPost()) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database"))));
+        return;
+    }
+
+    const QDir dir = backupsDir(c);
+    if (!dir.exists() && !dir.mkpath(dir.absolutePath())) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::errorQuery(c, QStringLiteral("Could not create backups directory."))));
+        return;
+    }
+
+    const bool compress = c->request()->bodyParam(QStringLiteral("gzip")) == QLatin1String("on");
+    QString filename = QLatin1String("cmlyst-") +
+            QDateTime::currentDateTimeUtc().toString(QStringLiteral("yyyyMMdd-HHmmss")) +
+            QLatin1String(".sqlite");
+    if (compress) {
+        filename.append(QLatin1String(".gz"));
+    }
+
+    // The copy sleeps between steps, so it runs as a job instead of holding this worker
+    if (c->config(QStringLiteral("JobThreads"), 2).toInt() > 0) {
+        if (CMS::JobScheduler::enqueue(QStringLiteral("backup"), {
+                                           {QStringLiteral("destination"), dir.absoluteFilePath(filename)},
+                                           {QStringLiteral("compress"), compress}
+                                       })) {
+            c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                              StatusMessage::statusQuery(c, QStringLiteral("Backup '%1' started, it is listed once written.").arg(filename))));
+        } else {
+            c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                              StatusMessage::errorQuery(c, QStringLiteral("Failed to schedule backup, check application logs."))));
+        }
+    } else if (engine->backup(dir.absoluteFilePath(filename), compress)) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::statusQuery(c, QStringLiteral("Backup '%1' created.").arg(filename))));
+    } else {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::errorQuery(c, QStringLiteral("Failed to create backup, check application logs."))));
+    }
+}
+
+void AdminSettings::backup_restore(Context *c)
+{
+    if (!c->request()->isPost()) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database"))));
+        return;
+    }
+
+    // Only allow plain file names from the backups directory
+    const QString filename = QFileInfo(c->request()->bodyParam(QStringLiteral("backup"))).fileName();
+    const QDir dir = backupsDir(c);
+    if (filename.isEmpty() || !dir.exists(filename)) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::errorQuery(c, QStringLiteral("Backup not found."))));
+        return;
+    }
+
+    if (engine->restore(dir.absoluteFilePath(filename))) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::statusQuery(c, QStringLiteral("Backup '%1' restored.").arg(filename))));
+    } else {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::errorQuery(c, QStringLiteral("Failed to restore backup, check application logs."))));
+    }
+}
+
+void AdminSettings::static_export(Context *c)
+{
+    if (!c->request()->isPost()) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database"))));
+        return;
+    }
+
+    if (m_exporter) {
+        c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                          StatusMessage::errorQuery(c, QStringLiteral("A static export is already running."))));
+        return;
+    }
+
+    // The exporter requests pages from this same server, so it must
+    // run asynchronously or this worker would never answer them
+    const QUrl baseUrl(c->config(QStringLiteral("StaticBaseUrl"), c->request()->base()).toString());
+    m_exporter = new StaticExporter(baseUrl, staticOutput(c), this);
+    m_exporter->setFullBuild(c->request()->bodyParam(QStringLiteral("full")) == QLatin1String("on"));
+    m_exporter->setManifestToken(c->config(QStringLiteral("ManifestToken")).toString());
+    connect(m_exporter.data(), &StaticExporter::finished, m_exporter.data(), &StaticExporter::deleteLater);
+    m_exporter->start();
+
+    c->response()->redirect(c->uriFor(CActionFor(QStringLiteral("database")),
+                                      StatusMessage::statusQuery(c, QStringLiteral("Static export started, check application logs for the result."))));
+}
+
+QString AdminSettings::staticOutput(Context *c) const
+{
+    return c->config(QStringLiteral("StaticOutput"),
+                     c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/static")).toString();
+}
+
+QDir AdminSettings::backupsDir(Context *c) const
+{
+    return QDir(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/backups"));
+}
@@ -22,8 +22,13 @@
 
 #include <Cutelyst/Controller>
 
+#include <QDir>
+#include <QPointer>
+
 #include "cmengine.h"
 
+class StaticExporter;
+
 using namespace Cutelyst;
 
 class AdminSettings : public Controller, public CMEngine
@@ -65,6 +70,21 @@ public:
 
     C_ATTR(db_clean, :Local :AutoArgs)
     void db_clean(Context *c);
+
+    C_ATTR(backup, :Local :AutoArgs)
+    void backup(Context *c);
+
+    C_ATTR(backup_restore, :Local :AutoArgs)
+    void backup_restore(Context *c);
+
+    C_ATTR(static_export, :Local :AutoArgs)
+    void static_export(Context *c);
+
+private:
+    QDir backupsDir(Context *c) const;
+    QString staticOutput(Context *c) const;
+
+    QPointer<StaticExporter> m_exporter;
 };
 
 #endif // ADMINSETTINGS_H
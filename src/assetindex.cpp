@@ -0,0 +1,102 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "assetindex.h"
+
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QHash>
+#include <QMutex>
+#include <QDateTime>
+
+struct Fingerprint {
+    QDateTime modified;
+    qint64 size;
+    QString hash;
+};
+
+static QString root;
+static QMutex mutex;
+static QHash<QString, Fingerprint> fingerprints;
+
+void AssetIndex::setRoot(const QString &staticDir)
+{
+    root = QDir(staticDir).absolutePath();
+}
+
+QString AssetIndex::filePath(const QString &path)
+{
+    const QString file = QDir::cleanPath(root + QLatin1Char('/') + path);
+    if (root.isEmpty() || !file.startsWith(root + QLatin1Char('/'))) {
+        return QString();
+    }
+    return file;
+}
+
+QString AssetIndex::fingerprint(const QString &path)
+{
+    const QString file = filePath(path);
+    const QFileInfo info(file);
+    if (file.isEmpty() || !info.isFile()) {
+        return QString();
+    }
+
+    QMutexLocker locker(&mutex);
+    auto it = fingerprints.constFind(file);
+    if (it != fingerprints.constEnd() && it->modified == info.lastModified() && it->size == info.size()) {
+        return it->hash;
+    }
+    locker.unlock();
+
+    QFile asset(file);
+    if (!asset.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hash.addData(&asset)) {
+        return QString();
+    }
+
+    const Fingerprint fingerprint = {
+        info.lastModified(),
+        info.size(),
+        QString::fromLatin1(hash.result().toHex().left(12))
+    };
+
+    locker.relock();
+    fingerprints.insert(file, fingerprint);
+    return fingerprint.hash;
+}
+
+QString AssetIndex::url(const QString &path)
+{
+    QString relative = path;
+    if (relative.startsWith(QLatin1Char('/'))) {
+        relative.remove(0, 1);
+    }
+
+    const QString hash = fingerprint(relative);
+    if (hash.isEmpty()) {
+        return QLatin1String("/static/") + relative;
+    }
+    return QLatin1String("/.asset/") + hash + QLatin1Char('/') + relative;
+}
@@ -0,0 +1,52 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef ASSETINDEX_H
+#define ASSETINDEX_H
+
+#include <QString>
+
+/**
+ * Content fingerprints of the files under root/static, an asset
+ * URL changes whenever its content does so it can be cached forever
+ */
+class AssetIndex
+{
+public:
+    static void setRoot(const QString &staticDir);
+
+    /**
+     * Absolute file path of an asset, or an empty
+     * string if it points outside the static directory
+     */
+    static QString filePath(const QString &path);
+
+    /**
+     * Returns a hash of the asset content, empty if it doesn't exist
+     */
+    static QString fingerprint(const QString &path);
+
+    /**
+     * Returns /.asset/<fingerprint>/path, or /static/path if
+     * the asset could not be read
+     */
+    static QString url(const QString &path);
+};
+
+#endif // ASSETINDEX_H
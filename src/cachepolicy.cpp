@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "cachepolicy.h"
+
+#include <Cutelyst/Application>
+#include <Cutelyst/Context>
+#include <Cutelyst/Response>
+
+#include <QHash>
+
+using namespace Cutelyst;
+
+#define CACHE_ROUTE_PROPERTY "_cache_route"
+
+static QHash<int, QString> policies;
+
+void CachePolicy::setup(Application *app)
+{
+    // Proxies are purged on changes so they can keep things longer than browsers
+    const QList<QPair<Route, QPair<QString, QString> > > defaults = {
+        { Page, { QStringLiteral("CacheControlPage"), QStringLiteral("public, max-age=60, s-maxage=86400, stale-while-revalidate=300") } },
+        { Listing, { QStringLiteral("CacheControlListing"), QStringLiteral("public, max-age=30, s-maxage=3600, stale-while-revalidate=60") } },
+        { Author, { QStringLiteral("CacheControlAuthor"), QStringLiteral("public, max-age=60, s-maxage=3600, stale-while-revalidate=60") } },
+        { Feed, { QStringLiteral("CacheControlFeed"), QStringLiteral("public, max-age=300, s-maxage=3600") } },
+        { Asset, { QStringLiteral("CacheControlAsset"), QStringLiteral("public, max-age=31536000, immutable") } },
+        { Media, { QStringLiteral("CacheControlMedia"), QStringLiteral("public, max-age=31536000, immutable") } },
+        { NotFound, { QStringLiteral("CacheControlNotFound"), QStringLiteral("public, max-age=60") } },
+    };
+
+    for (const auto &policy : defaults) {
+        policies.insert(policy.first, app->config(policy.second.first, policy.second.second).toString());
+    }
+}
+
+QString CachePolicy::cacheControl(Route route)
+{
+    return policies.value(route);
+}
+
+void CachePolicy::setRoute(Context *c, Route route)
+{
+    c->setProperty(CACHE_ROUTE_PROPERTY, int(route));
+}
+
+void CachePolicy::apply(Context *c)
+{
+    Response *res = c->res();
+
+    Route route = Route(c->property(CACHE_ROUTE_PROPERTY).toInt());
+    if (res->status() == Response::NotFound) {
+        route = NotFound;
+    } else if (res->status() != Response::OK && res->status() != Response::NotModified && res->status() != 206) {
+        return;
+    }
+
+    const QString value = cacheControl(route);
+    if (!value.isEmpty()) {
+        res->headers().setHeader(QStringLiteral("Cache-Control"), value);
+    }
+}
@@ -0,0 +1,64 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef CACHEPOLICY_H
+#define CACHEPOLICY_H
+
+#include <QString>
+
+namespace Cutelyst {
+class Application;
+class Context;
+}
+
+/**
+ * Cache-Control sent for each kind of route, read once from
+ * the CacheControl* config keys, an empty value sends nothing
+ */
+class CachePolicy
+{
+public:
+    enum Route {
+        None,
+        Page,
+        Listing,
+        Author,
+        Feed,
+        Asset,
+        Media,
+        NotFound
+    };
+
+    static void setup(Cutelyst::Application *app);
+
+    static QString cacheControl(Route route);
+
+    /**
+     * Marks the kind of route c is rendering
+     */
+    static void setRoute(Cutelyst::Context *c, Route route);
+
+    /**
+     * Sets Cache-Control for the route c was marked with, or
+     * the NotFound one if that's the response status
+     */
+    static void apply(Cutelyst::Context *c);
+};
+
+#endif // CACHEPOLICY_H
@@ -0,0 +1,156 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "cachetag.h"
+
+#include <grantlee/exception.h>
+#include <grantlee/parser.h>
+#include <grantlee/util.h>
+
+#include <QTextStream>
+#include <QThreadStorage>
+
+#include "libCMS/engine.h"
+#include "libCMS/fragmentcache.h"
+#include "libCMS/imagederivatives.h"
+
+#include "assetindex.h"
+
+// Filters don't see the request, renders of a thread run one at a time
+static QThreadStorage<QStringList> srcsetDependencies;
+
+CacheTagLibrary::CacheTagLibrary(QObject *parent) : QObject(parent)
+{
+
+}
+
+QHash<QString, Grantlee::AbstractNodeFactory *> CacheTagLibrary::nodeFactories(const QString &name)
+{
+    Q_UNUSED(name)
+    return {
+        { QStringLiteral("cache"), new CacheNodeFactory }
+    };
+}
+
+QHash<QString, Grantlee::Filter *> CacheTagLibrary::filters(const QString &name)
+{
+    Q_UNUSED(name)
+    return {
+        { QStringLiteral("asset"), new AssetFilter },
+        { QStringLiteral("srcset"), new SrcsetFilter }
+    };
+}
+
+QVariant AssetFilter::doFilter(const QVariant &input, const QVariant &argument, bool autoescape) const
+{
+    Q_UNUSED(argument)
+    Q_UNUSED(autoescape)
+    return AssetIndex::url(Grantlee::getSafeString(input).get());
+}
+
+bool AssetFilter::isSafe() const
+{
+    return true;
+}
+
+QVariant SrcsetFilter::doFilter(const QVariant &input, const QVariant &argument, bool autoescape) const
+{
+    Q_UNUSED(autoescape)
+    const QString url = Grantlee::getSafeString(input).get();
+    const QString hash = CMS::ImageDerivatives::hash(url);
+    if (!hash.isEmpty()) {
+        srcsetDependencies.localData().append(QLatin1String("media:") + hash);
+    }
+    return CMS::ImageDerivatives::instance()->srcset(url, Grantlee::getSafeString(argument).get());
+}
+
+QStringList SrcsetFilter::takeDependencies()
+{
+    QStringList ret;
+    ret.swap(srcsetDependencies.localData());
+    return ret;
+}
+
+bool SrcsetFilter::isSafe() const
+{
+    return true;
+}
+
+CacheNodeFactory::CacheNodeFactory(QObject *parent) : Grantlee::AbstractNodeFactory(parent)
+{
+
+}
+
+Grantlee::Node *CacheNodeFactory::getNode(const QString &tagContent, Grantlee::Parser *p) const
+{
+    const QStringList expr = smartSplit(tagContent);
+    if (expr.size() < 2) {
+        throw Grantlee::Exception(Grantlee::TagSyntaxError,
+                                  QStringLiteral("cache tag requires at least one argument"));
+    }
+
+    QList<Grantlee::FilterExpression> key;
+    for (int i = 1; i < expr.size(); ++i) {
+        key.append(Grantlee::FilterExpression(expr.at(i), p));
+    }
+
+    auto node = new CacheNode(key, p);
+    node->setNodeList(p->parse(node, QStringLiteral("endcache")));
+    p->removeNextToken();
+
+    return node;
+}
+
+CacheNode::CacheNode(const QList<Grantlee::FilterExpression> &key, QObject *parent) : Grantlee::Node(parent)
+  , m_key(key)
+{
+
+}
+
+void CacheNode::setNodeList(const Grantlee::NodeList &list)
+{
+    m_list = list;
+}
+
+void CacheNode::render(Grantlee::OutputStream *stream, Grantlee::Context *c) const
+{
+    auto engine = qobject_cast<CMS::Engine *>(c->lookup(QStringLiteral("cms")).value<QObject *>());
+    if (!engine) {
+        m_list.render(stream, c);
+        return;
+    }
+
+    QStringList parts;
+    for (const Grantlee::FilterExpression &fe : m_key) {
+        parts.append(Grantlee::getSafeString(fe.resolve(c)).get());
+    }
+    const QString key = parts.join(QChar(0x1f));
+
+    CMS::FragmentCache *cache = engine->fragmentCache();
+    QString fragment = cache->value(key);
+    if (fragment.isNull()) {
+        QTextStream textStream(&fragment);
+        QSharedPointer<Grantlee::OutputStream> temp = stream->clone(&textStream);
+        m_list.render(temp.data(), c);
+        textStream.flush();
+        cache->insert(key, fragment);
+    }
+
+    (*stream) << fragment;
+}
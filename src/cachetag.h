@@ -0,0 +1,100 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef CACHETAG_H
+#define CACHETAG_H
+
+#include <grantlee/taglibraryinterface.h>
+#include <grantlee/node.h>
+#include <grantlee/filterexpression.h>
+#include <grantlee/filter.h>
+
+/**
+ * {% cache "name" var1 var2 %}...{% endcache %}
+ *
+ * Renders the enclosed block once for each combination of its
+ * arguments and stores it in the engine fragment cache, which
+ * is cleared when the settings generation changes
+ *
+ * {{ "themes/default/blog.css"|asset }}
+ *
+ * Returns the fingerprinted URL of a file under root/static
+ *
+ * {{ image_url|srcset }} {{ image_url|srcset:"webp" }}
+ *
+ * Returns the srcset of the resized copies of an uploaded image,
+ * in its own format or the given one, pages using it are rendered
+ * again once more copies exist unless it's inside a cache block
+ */
+class CacheTagLibrary : public QObject, public Grantlee::TagLibraryInterface
+{
+    Q_OBJECT
+    Q_INTERFACES(Grantlee::TagLibraryInterface)
+public:
+    explicit CacheTagLibrary(QObject *parent = 0);
+
+    virtual QHash<QString, Grantlee::AbstractNodeFactory *> nodeFactories(const QString &name = QString()) override;
+    virtual QHash<QString, Grantlee::Filter *> filters(const QString &name = QString()) override;
+};
+
+class SrcsetFilter : public Grantlee::Filter
+{
+public:
+    virtual QVariant doFilter(const QVariant &input, const QVariant &argument = QVariant(), bool autoescape = false) const override;
+    virtual bool isSafe() const override;
+
+    /**
+     * Returns the "media:<hash>" entities of the images
+     * filtered on this thread since the last call
+     */
+    static QStringList takeDependencies();
+};
+
+class AssetFilter : public Grantlee::Filter
+{
+public:
+    virtual QVariant doFilter(const QVariant &input, const QVariant &argument = QVariant(), bool autoescape = false) const override;
+    virtual bool isSafe() const override;
+};
+
+class CacheNodeFactory : public Grantlee::AbstractNodeFactory
+{
+    Q_OBJECT
+public:
+    explicit CacheNodeFactory(QObject *parent = 0);
+
+    virtual Grantlee::Node *getNode(const QString &tagContent, Grantlee::Parser *p) const override;
+};
+
+class CacheNode : public Grantlee::Node
+{
+    Q_OBJECT
+public:
+    CacheNode(const QList<Grantlee::FilterExpression> &key, QObject *parent = 0);
+
+    void setNodeList(const Grantlee::NodeList &list);
+
+    virtual void render(Grantlee::OutputStream *stream, Grantlee::Context *c) const override;
+
+private:
+    QList<Grantlee::FilterExpression> m_key;
+    Grantlee::NodeList m_list;
+};
+
+#endif // CACHETAG_H
@@ -57,8 +57,10 @@ DispatchType::MatchType CMDispatcher::match(Context *c, const QString &path, con
     CMS::Page *page;
     if (path.isEmpty() && !showPostsOnFront) {
         page = engine->getPage(settings.value(QStringLiteral("page_on_front")), c);
-    } else {
+    } else if (engine->hasPublishedPath(path)) {
         page = engine->getPage(path, c);
+    } else {
+        return NoMatch;
     }
 
     if (page && page->published()) {
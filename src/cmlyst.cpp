@@ -28,6 +28,7 @@
 #include <Cutelyst/Plugins/StatusMessage>
 
 #include <QStandardPaths>
+#include <QResource>
 #include <QDir>
 #include <QDebug>
 
@@ -42,8 +43,18 @@
 
 #include "cmdispatcher.h"
 #include "sqluserstore.h"
+#include "cachetag.h"
+#include "purgenotifier.h"
+#include "outputcacheplugin.h"
+#include "cachepolicy.h"
+#include "assetindex.h"
+#include "fileserver.h"
 
 #include "libCMS/sqlengine.h"
+#include "libCMS/pgsqlengine.h"
+#include "libCMS/imagederivatives.h"
+#include "libCMS/mediastore.h"
+#include "libCMS/jobscheduler.h"
 #include "libCMS/page.h"
 #include "libCMS/menu.h"
 
@@ -67,10 +78,15 @@ bool CMlyst::init()
     bool production = config(QStringLiteral("production")).toBool();
     qDebug() << "Production" << production;
 
+    // Parsing templates here instead of on first use makes forked
+    // workers start with all of them already compiled
+    const bool preload = config(QStringLiteral("PreloadTemplates"), production).toBool();
+
     auto view = new GrantleeView(this);
     view->setTemplateExtension(QStringLiteral(".html"));
     view->setWrapper(QStringLiteral("base.html"));
-    view->setCache(production);
+    view->setCache(production || preload);
+    view->engine()->insertDefaultLibrary(QStringLiteral("cmlyst_cache"), new CacheTagLibrary(view->engine()));
 
     const QDir dataDir = config(QStringLiteral("DataLocation"), QStandardPaths::writableLocation(QStandardPaths::DataLocation)).toString();
     if (!dataDir.exists() && !dataDir.mkpath(dataDir.absolutePath())) {
@@ -79,13 +95,62 @@ bool CMlyst::init()
     }
     setConfig(QStringLiteral("DataLocation"), dataDir.absolutePath());
 
-    view->setIncludePaths({ pathTo(QStringLiteral("root/themes/default")) });
+    QString themesPath = pathTo(QStringLiteral("root/themes"));
+    QString adminPath = pathTo(QStringLiteral("root/admin"));
+    const QString bundle = config(QStringLiteral("TemplateBundle")).toString();
+    if (!bundle.isEmpty()) {
+        if (!QResource::registerResource(bundle, QStringLiteral("/cmlyst"))) {
+            qCritical() << "Could not load template bundle" << bundle;
+            return false;
+        }
+        themesPath = QStringLiteral(":/cmlyst/themes");
+        adminPath = QStringLiteral(":/cmlyst/admin");
+    }
+    setConfig(QStringLiteral("ThemesPath"), themesPath);
+
+    // The theme setting is only read after forking, Theme tells which
+    // one to preload, the engine reports it if it's a different one
+    m_theme = config(QStringLiteral("Theme"), QStringLiteral("default")).toString();
+    if (!QDir(themesPath + QLatin1Char('/') + m_theme).exists()) {
+        qWarning() << "Theme not found, preloading the default one" << m_theme;
+        m_theme = QStringLiteral("default");
+    }
+    view->setIncludePaths({ themesPath + QLatin1Char('/') + m_theme });
+
+    CachePolicy::setup(this);
+    AssetIndex::setRoot(pathTo(QStringLiteral("root/static")));
+    FileServer::setup(this);
+
+    // Shared by every worker thread, so only configured before forking
+    QVector<int> widths;
+    const QStringList widthList = config(QStringLiteral("MediaImageWidths"), QStringLiteral("320,640,1024,1600")).toString()
+            .split(QLatin1Char(','), QString::SkipEmptyParts);
+    for (const QString &width : widthList) {
+        if (width.trimmed().toInt() > 0) {
+            widths.append(width.trimmed().toInt());
+        }
+    }
+    QList<QByteArray> formats;
+    const QStringList formatList = config(QStringLiteral("MediaImageFormats"), QStringLiteral("webp,avif")).toString()
+            .split(QLatin1Char(','), QString::SkipEmptyParts);
+    for (const QString &format : formatList) {
+        formats.append(format.trimmed().toLatin1());
+    }
+    CMS::ImageDerivatives::instance()->configure(dataDir.absoluteFilePath(QStringLiteral("media")),
+                                                 widths,
+                                                 formats,
+                                                 config(QStringLiteral("MediaImageQuality"), 80).toInt());
 
     auto adminView = new GrantleeView(this, QStringLiteral("admin"));
     adminView->setTemplateExtension(QStringLiteral(".html"));
     adminView->setWrapper(QStringLiteral("wrapper.html"));
-    adminView->setIncludePaths({ pathTo(QStringLiteral("root/admin")) });
-    adminView->setCache(production);
+    adminView->setIncludePaths({ adminPath });
+    adminView->setCache(production || preload);
+
+    if (preload) {
+        view->preloadTemplates();
+        adminView->preloadTemplates();
+    }
 
     if (qEnvironmentVariableIsSet("SETUP")) {
         new AdminSetup(this);
@@ -116,6 +181,10 @@ bool CMlyst::init()
 
     new StatusMessage(this);
 
+    if (config(QStringLiteral("OutputCache"), production).toBool()) {
+        m_outputCache = new OutputCachePlugin(this);
+    }
+
     qDebug() << "Root location" << pathTo(QStringLiteral("root"));
     qDebug() << "Root Admin location" << pathTo(QStringLiteral("root/src/admin"));
     qDebug() << "Data location" << dataDir.absolutePath();
@@ -127,10 +196,46 @@ bool CMlyst::postFork()
 {
     QDir dataDir = config(QStringLiteral("DataLocation")).toString();
 
-    auto engine = new CMS::SqlEngine(this);
-    engine->init({
-                     {QStringLiteral("root"), dataDir.absolutePath()}
-                 });
+    CMS::SqlEngine *engine;
+    const QString engineName = config(QStringLiteral("Engine"), QStringLiteral("sqlite")).toString();
+    if (engineName == QLatin1String("postgres")) {
+        engine = new CMS::PgSqlEngine(this);
+        if (!engine->init({
+                          {QStringLiteral("host"), config(QStringLiteral("PgHost")).toString()},
+                          {QStringLiteral("ro_host"), config(QStringLiteral("PgReadOnlyHost"), config(QStringLiteral("PgHost"))).toString()},
+                          {QStringLiteral("port"), config(QStringLiteral("PgPort"), QStringLiteral("5432")).toString()},
+                          {QStringLiteral("database"), config(QStringLiteral("PgDatabase"), QStringLiteral("cmlyst")).toString()},
+                          {QStringLiteral("user"), config(QStringLiteral("PgUser")).toString()},
+                          {QStringLiteral("password"), config(QStringLiteral("PgPassword")).toString()},
+                          {QStringLiteral("connect_timeout"), config(QStringLiteral("PgConnectTimeout"), QStringLiteral("10")).toString()},
+                          {QStringLiteral("max_connections"), config(QStringLiteral("PgMaxConnections"), QStringLiteral("20")).toString()},
+                          {QStringLiteral("fragment_cache_size"), config(QStringLiteral("FragmentCacheSize"), QStringLiteral("4194304")).toString()},
+                          {QStringLiteral("revision_snapshot_interval"), config(QStringLiteral("RevisionSnapshotInterval"), QStringLiteral("20")).toString()},
+                          {QStringLiteral("compress_threshold"), config(QStringLiteral("ContentCompressThreshold"), QStringLiteral("512")).toString()},
+                      })) {
+            return false;
+        }
+    } else {
+        engine = new CMS::SqlEngine(this);
+        if (!engine->init({
+                          {QStringLiteral("root"), dataDir.absolutePath()},
+                          {QStringLiteral("synchronous"), config(QStringLiteral("SqliteSynchronous"), QStringLiteral("NORMAL")).toString()},
+                          {QStringLiteral("cache_size"), config(QStringLiteral("SqliteCacheSize"), QStringLiteral("-16000")).toString()},
+                          {QStringLiteral("mmap_size"), config(QStringLiteral("SqliteMmapSize"), QStringLiteral("268435456")).toString()},
+                          {QStringLiteral("ro_mmap_size"), config(QStringLiteral("SqliteReadOnlyMmapSize"), QStringLiteral("1073741824")).toString()},
+                          {QStringLiteral("temp_store"), config(QStringLiteral("SqliteTempStore"), QStringLiteral("MEMORY")).toString()},
+                          {QStringLiteral("busy_timeout"), config(QStringLiteral("SqliteBusyTimeout"), QStringLiteral("5000")).toString()},
+                          {QStringLiteral("checkpoint_interval"), config(QStringLiteral("SqliteCheckpointInterval"), QStringLiteral("60")).toString()},
+                          {QStringLiteral("checkpoint_idle"), config(QStringLiteral("SqliteCheckpointIdle"), QStringLiteral("300")).toString()},
+                          {QStringLiteral("fragment_cache_size"), config(QStringLiteral("FragmentCacheSize"), QStringLiteral("4194304")).toString()},
+                          {QStringLiteral("revision_snapshot_interval"), config(QStringLiteral("RevisionSnapshotInterval"), QStringLiteral("20")).toString()},
+                          {QStringLiteral("compress_threshold"), config(QStringLiteral("ContentCompressThreshold"), QStringLiteral("512")).toString()},
+                      })) {
+            return false;
+        }
+    }
+
+    connect(engine, &CMS::Engine::themeChanged, this, &CMlyst::setTheme);
 
     Q_FOREACH (Controller *controller, controllers()) {
         auto cmengine = dynamic_cast<CMEngine *>(controller);
@@ -146,5 +251,96 @@ bool CMlyst::postFork()
         }
     }
 
+    if (m_outputCache) {
+        m_outputCache->setEngine(engine);
+    }
+
+    const QUrl purgeUrl = config(QStringLiteral("PurgeUrl")).toUrl();
+    if (purgeUrl.isValid()) {
+        auto notifier = new PurgeNotifier(engine, purgeUrl, this);
+        notifier->setMethod(config(QStringLiteral("PurgeMethod"), QStringLiteral("PURGE")).toString().toLatin1());
+        notifier->setKeyHeader(config(QStringLiteral("SurrogateKeyHeader"), QStringLiteral("Surrogate-Key")).toString().toLatin1());
+        notifier->setMaxAttempts(config(QStringLiteral("PurgeAttempts"), 3).toInt());
+    }
+
+    // Thread pools must not be started before forking
+    // Every process enqueues, the one holding the lock runs them
+    if (config(QStringLiteral("JobThreads"), 2).toInt() > 0) {
+        auto jobs = new CMS::JobScheduler(this);
+        jobs->setMaxAttempts(config(QStringLiteral("JobMaxAttempts"), 5).toInt());
+        jobs->setBackoff(config(QStringLiteral("JobBackoff"), 30).toInt());
+        jobs->setPollInterval(config(QStringLiteral("JobPollInterval"), 5000).toInt());
+
+        jobs->registerHandler(QStringLiteral("media-derivatives"), [] (const QJsonObject &payload, QString *error) {
+            if (!CMS::ImageDerivatives::instance()->generate(payload.value(QStringLiteral("hash")).toString(), error)) {
+                return false;
+            }
+            // Pages rendered before offered fewer sizes
+            return CMS::JobScheduler::enqueue(QStringLiteral("media-invalidate"), payload);
+        });
+
+        jobs->registerHandler(QStringLiteral("media-invalidate"), [engine] (const QJsonObject &payload, QString *error) {
+            Q_UNUSED(error)
+            return engine->invalidateMedia(payload.value(QStringLiteral("hash")).toString());
+        }, engine);
+
+        // On the engine's thread as it owns the connections and caches
+        jobs->registerHandler(QStringLiteral("publish-scheduled"), [engine] (const QJsonObject &payload, QString *error) {
+            Q_UNUSED(payload)
+            return engine->publishScheduled(error) != -1;
+        }, engine);
+
+        const QString mediaRoot = dataDir.absoluteFilePath(QStringLiteral("media"));
+        jobs->registerHandler(QStringLiteral("media-reconcile"), [mediaRoot] (const QJsonObject &payload, QString *error) {
+            Q_UNUSED(payload)
+            CMS::MediaStore store(mediaRoot);
+            const QHash<QString, int> counts = store.reconcile();
+            qDebug() << "Media reconciled" << counts;
+            *error = store.errorString();
+            return error->isEmpty();
+        });
+
+        // Only reads the database path, the copy runs off the request threads
+        jobs->registerHandler(QStringLiteral("backup"), [engine] (const QJsonObject &payload, QString *error) {
+            const QString destination = payload.value(QStringLiteral("destination")).toString();
+            if (!engine->backup(destination, payload.value(QStringLiteral("compress")).toBool())) {
+                *error = QLatin1String("Failed to create backup ") + destination;
+                return false;
+            }
+            qDebug() << "Backup created" << destination;
+            return true;
+        });
+
+        jobs->start(dataDir.absoluteFilePath(QStringLiteral("jobs.lock")),
+                    config(QStringLiteral("JobThreads"), 2).toInt());
+    }
+
+    // Load everything the first requests would otherwise load
+    if (!engine->warmUp(this)) {
+        qWarning() << "Failed to warm up engine, caches will be loaded on demand";
+    }
+
     return true;
 }
+
+void CMlyst::setTheme(const QString &theme)
+{
+    // Templates of the theme preloaded before forking stay compiled
+    if (theme == m_theme) {
+        return;
+    }
+    m_theme = theme;
+
+    auto view = qobject_cast<GrantleeView *>(this->view());
+    if (view->isCaching()) {
+        // Drops templates compiled from the previous theme, but also
+        // recreates the Grantlee engine without our libraries
+        view->setCache(false);
+        view->setCache(true);
+        view->engine()->insertDefaultLibrary(QStringLiteral("cmlyst_cache"), new CacheTagLibrary(view->engine()));
+    }
+    view->setIncludePaths({ config(QStringLiteral("ThemesPath")).toString() + QLatin1Char('/') + theme });
+    if (view->isCaching()) {
+        view->preloadTemplates();
+    }
+}
@@ -22,6 +22,8 @@
 
 #include <Cutelyst/Application>
 
+class OutputCachePlugin;
+
 class CMlyst : public Cutelyst::Application
 {
     Q_OBJECT
@@ -33,6 +35,12 @@ public:
     bool init();
 
     virtual bool postFork();
+
+private:
+    void setTheme(const QString &theme);
+
+    OutputCachePlugin *m_outputCache = nullptr;
+    QString m_theme;
 };
 
 #endif // CMLYST_H
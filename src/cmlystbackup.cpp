@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+#include "libCMS/sqlitebackup.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QStringLiteral("cmlyst-backup"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Online backup and restore of a CMlyst SQLite database"));
+    parser.addHelpOption();
+
+    QCommandLineOption compressOpt({ QStringLiteral("z"), QStringLiteral("gzip") },
+                                   QStringLiteral("Compress the backup with gzip."));
+    parser.addOption(compressOpt);
+
+    QCommandLineOption pagesOpt({ QStringLiteral("p"), QStringLiteral("pages") },
+                                QStringLiteral("Number of pages copied on each step."),
+                                QStringLiteral("pages"), QStringLiteral("128"));
+    parser.addOption(pagesOpt);
+
+    QCommandLineOption sleepOpt({ QStringLiteral("s"), QStringLiteral("sleep") },
+                                QStringLiteral("Milliseconds to sleep between steps."),
+                                QStringLiteral("msecs"), QStringLiteral("20"));
+    parser.addOption(sleepOpt);
+
+    parser.addPositionalArgument(QStringLiteral("command"), QStringLiteral("backup or restore"));
+    parser.addPositionalArgument(QStringLiteral("source"), QStringLiteral("Database to backup or backup file to restore"));
+    parser.addPositionalArgument(QStringLiteral("destination"), QStringLiteral("Backup file or database to restore into"));
+
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() != 3) {
+        parser.showHelp(1);
+    }
+
+    CMS::SqliteBackup backup;
+    backup.setPagesPerStep(parser.value(pagesOpt).toInt());
+    backup.setSleepInterval(parser.value(sleepOpt).toInt());
+
+    bool ret = false;
+    if (args.at(0) == QLatin1String("backup")) {
+        ret = backup.backup(args.at(1), args.at(2), parser.isSet(compressOpt));
+    } else if (args.at(0) == QLatin1String("restore")) {
+        ret = backup.restore(args.at(1), args.at(2));
+    } else {
+        parser.showHelp(1);
+    }
+
+    if (!ret) {
+        QTextStream err(stderr);
+        err << backup.errorString() << '\n';
+        err.flush();
+        return 1;
+    }
+    return 0;
+}
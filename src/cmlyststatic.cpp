@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include "staticexporter.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    app.setApplicationName(QStringLiteral("cmlyst-static"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Renders a running CMlyst site into static files"));
+    parser.addHelpOption();
+
+    QCommandLineOption fullOpt({ QStringLiteral("f"), QStringLiteral("full") },
+                               QStringLiteral("Render every output, not only the ones that changed."));
+    parser.addOption(fullOpt);
+
+    QCommandLineOption noGzipOpt(QStringLiteral("no-gzip"),
+                                 QStringLiteral("Don't write precompressed .gz files."));
+    parser.addOption(noGzipOpt);
+
+    QCommandLineOption jobsOpt({ QStringLiteral("j"), QStringLiteral("jobs") },
+                               QStringLiteral("Number of concurrent requests."),
+                               QStringLiteral("jobs"), QStringLiteral("4"));
+    parser.addOption(jobsOpt);
+
+    QCommandLineOption tokenOpt({ QStringLiteral("t"), QStringLiteral("token") },
+                                QStringLiteral("ManifestToken of the site, needed unless it runs on the same host."),
+                                QStringLiteral("token"));
+    parser.addOption(tokenOpt);
+
+    parser.addPositionalArgument(QStringLiteral("url"), QStringLiteral("Base URL of the site, like http://localhost:3000"));
+    parser.addPositionalArgument(QStringLiteral("output"), QStringLiteral("Directory where files are written"));
+
+    parser.process(app);
+
+    const QStringList args = parser.positionalArguments();
+    if (args.size() != 2) {
+        parser.showHelp(1);
+    }
+
+    StaticExporter exporter(QUrl::fromUserInput(args.at(0)), args.at(1));
+    exporter.setFullBuild(parser.isSet(fullOpt));
+    exporter.setCompress(!parser.isSet(noGzipOpt));
+    exporter.setMaxRequests(parser.value(jobsOpt).toInt());
+    exporter.setManifestToken(parser.value(tokenOpt));
+
+    QObject::connect(&exporter, &StaticExporter::finished, &app, [&app] (bool ok) {
+        app.exit(ok ? 0 : 1);
+    });
+    exporter.start();
+
+    return app.exec();
+}
@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "fileserver.h"
+
+#include <Cutelyst/Application>
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+#include <Cutelyst/Response>
+
+#include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+
+#include <limits>
+
+using namespace Cutelyst;
+
+static QString sendfileMode;
+static QString internalPrefix;
+
+// Responses without a body would otherwise be rendered by the view
+static void setEmptyBody(Context *c)
+{
+    auto buffer = new QBuffer(c);
+    buffer->open(QIODevice::ReadOnly);
+    c->res()->setBody(buffer);
+}
+
+void FileServer::setup(Application *app)
+{
+    sendfileMode = app->config(QStringLiteral("FileSendfile")).toString();
+    internalPrefix = app->config(QStringLiteral("FileSendfilePrefix"), QStringLiteral("/.media-internal/")).toString();
+}
+
+/**
+ * Parses a single "bytes=" range, multiple ranges are answered
+ * with the whole file which is allowed by RFC 7233
+ */
+static bool parseRange(const QString &header, qint64 size, qint64 *start, qint64 *end)
+{
+    if (!header.startsWith(QLatin1String("bytes=")) || header.contains(QLatin1Char(','))) {
+        return false;
+    }
+
+    const QString spec = header.mid(6).trimmed();
+    const int dash = spec.indexOf(QLatin1Char('-'));
+    if (dash == -1) {
+        return false;
+    }
+
+    bool ok;
+    if (dash == 0) {
+        // Last N bytes
+        const qint64 suffix = spec.mid(1).toLongLong(&ok);
+        if (!ok || suffix <= 0) {
+            return false;
+        }
+        *start = qMax(qint64(0), size - suffix);
+        *end = size - 1;
+        return true;
+    }
+
+    *start = spec.left(dash).toLongLong(&ok);
+    if (!ok) {
+        return false;
+    }
+
+    const QString last = spec.mid(dash + 1);
+    if (last.isEmpty()) {
+        *end = size - 1;
+    } else {
+        *end = qMin(last.toLongLong(&ok), size - 1);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FileServer::serve(Context *c, const QString &filePath, const QString &etag,
+                       const QString &contentType, const QString &internalPath)
+{
+    const QFileInfo info(filePath);
+    if (!info.isFile()) {
+        return false;
+    }
+
+    Request *req = c->req();
+    Response *res = c->res();
+    Headers &headers = res->headers();
+    headers.setHeader(QStringLiteral("ETag"), etag);
+    headers.setLastModified(info.lastModified());
+    headers.setHeader(QStringLiteral("Accept-Ranges"), QStringLiteral("bytes"));
+    res->setContentType(contentType);
+
+    if (req->headers().header(QStringLiteral("If-None-Match")) == etag) {
+        res->setStatus(Response::NotModified);
+        return true;
+    }
+
+    if (!internalPath.isEmpty()) {
+        // The front end server takes care of ranges too
+        if (sendfileMode == QLatin1String("nginx")) {
+            headers.setHeader(QStringLiteral("X-Accel-Redirect"), internalPrefix + internalPath);
+            setEmptyBody(c);
+            return true;
+        } else if (sendfileMode == QLatin1String("apache") || sendfileMode == QLatin1String("lighttpd")) {
+            headers.setHeader(QStringLiteral("X-Sendfile"), info.absoluteFilePath());
+            setEmptyBody(c);
+            return true;
+        }
+    }
+
+    const qint64 size = info.size();
+    qint64 start = 0;
+    qint64 end = size - 1;
+
+    // A range only applies to the version the client already has
+    const QString range = req->headers().header(QStringLiteral("Range"));
+    const QString ifRange = req->headers().header(QStringLiteral("If-Range"));
+    if (!range.isEmpty() && (ifRange.isEmpty() || ifRange == etag)) {
+        if (!parseRange(range, size, &start, &end)) {
+            start = 0;
+            end = size - 1;
+        } else if (start >= size || start > end) {
+            res->setStatus(416);
+            headers.setHeader(QStringLiteral("Content-Range"), QLatin1String("bytes */") + QString::number(size));
+            setEmptyBody(c);
+            return true;
+        } else {
+            // Partial responses may be shorter than asked, keeping them mappable
+            end = qMin(end, start + std::numeric_limits<int>::max() - 1);
+            res->setStatus(206);
+            headers.setHeader(QStringLiteral("Content-Range"),
+                              QLatin1String("bytes ") + QString::number(start) + QLatin1Char('-') +
+                              QString::number(end) + QLatin1Char('/') + QString::number(size));
+        }
+    }
+
+    auto file = new QFile(filePath, c);
+    if (!file->open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << filePath << file->errorString();
+        return false;
+    }
+
+    const qint64 length = end - start + 1;
+    if (size == 0) {
+        setEmptyBody(c);
+        return true;
+    }
+
+    // The mapping lives as long as the file, which lives as long as c
+    uchar *data = length <= std::numeric_limits<int>::max() ? file->map(start, length) : nullptr;
+    if (data) {
+        auto buffer = new QBuffer(c);
+        buffer->setData(QByteArray::fromRawData(reinterpret_cast<const char *>(data), int(length)));
+        buffer->open(QIODevice::ReadOnly);
+        res->setBody(buffer);
+    } else if (start == 0 && length == size) {
+        res->setBody(file);
+    } else {
+        file->seek(start);
+        res->setBody(file->read(length));
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef FILESERVER_H
+#define FILESERVER_H
+
+#include <QString>
+
+namespace Cutelyst {
+class Application;
+class Context;
+}
+
+/**
+ * Sends files with ETag, Last-Modified and Range support.
+ *
+ * When the front end server is configured to (FileSendfile), only
+ * a header telling it which file to send is returned, so it can use
+ * sendfile() itself, otherwise the file is memory mapped and handed
+ * to the engine without being read into a buffer first
+ */
+class FileServer
+{
+public:
+    static void setup(Cutelyst::Application *app);
+
+    /**
+     * Serves filePath, etag must be quoted, internalPath is the part
+     * after the media directory used for the nginx internal location
+     */
+    static bool serve(Cutelyst::Context *c, const QString &filePath, const QString &etag,
+                      const QString &contentType, const QString &internalPath = QString());
+};
+
+#endif // FILESERVER_H
@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "gzipwriter.h"
+
+#include <QIODevice>
+#include <QDebug>
+
+#define GZIP_CHUNK 16384
+
+GzipWriter::GzipWriter(QIODevice *device, int level, QObject *parent) : QObject(parent)
+  , m_device(device)
+{
+    m_stream.zalloc = Z_NULL;
+    m_stream.zfree = Z_NULL;
+    m_stream.opaque = Z_NULL;
+
+    // 15 window bits + 16 makes zlib write a gzip header and trailer
+    m_valid = deflateInit2(&m_stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!m_valid) {
+        qWarning() << "Failed to initialize gzip stream" << m_stream.msg;
+    }
+}
+
+GzipWriter::~GzipWriter()
+{
+    if (m_valid) {
+        deflateEnd(&m_stream);
+    }
+}
+
+bool GzipWriter::write(const char *data, qint64 len)
+{
+    if (!m_valid) {
+        return false;
+    }
+
+    m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    m_stream.avail_in = uInt(len);
+    return deflateTo(Z_NO_FLUSH);
+}
+
+bool GzipWriter::write(const QByteArray &data)
+{
+    return write(data.constData(), data.size());
+}
+
+bool GzipWriter::finish()
+{
+    if (!m_valid) {
+        return false;
+    }
+
+    m_stream.next_in = Z_NULL;
+    m_stream.avail_in = 0;
+    bool ret = deflateTo(Z_FINISH);
+
+    deflateEnd(&m_stream);
+    m_valid = false;
+
+    return ret;
+}
+
+bool GzipWriter::deflateTo(int flush)
+{
+    char out[GZIP_CHUNK];
+    do {
+        m_stream.next_out = reinterpret_cast<Bytef *>(out);
+        m_stream.avail_out = GZIP_CHUNK;
+
+        int ret = deflate(&m_stream, flush);
+        if (ret == Z_STREAM_ERROR) {
+            qWarning() << "Failed to compress gzip stream" << m_stream.msg;
+            return false;
+        }
+
+        const qint64 have = GZIP_CHUNK - m_stream.avail_out;
+        if (have && m_device->write(out, have) != have) {
+            qWarning() << "Failed to write gzip stream" << m_device->errorString();
+            return false;
+        }
+    } while (m_stream.avail_out == 0);
+
+    return true;
+}
@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef GZIPWRITER_H
+#define GZIPWRITER_H
+
+#include <QObject>
+
+#include <zlib.h>
+
+class QIODevice;
+
+/**
+ * Compresses everything written to it into a gzip stream
+ * that is written to device as soon as deflate produces output,
+ * so only a small fixed size buffer is kept in memory.
+ */
+class GzipWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit GzipWriter(QIODevice *device, int level = Z_DEFAULT_COMPRESSION, QObject *parent = 0);
+    ~GzipWriter();
+
+    bool write(const char *data, qint64 len);
+    bool write(const QByteArray &data);
+
+    /**
+     * Flushes the remaining compressed data and the gzip trailer,
+     * nothing can be written after this is called
+     */
+    bool finish();
+
+private:
+    bool deflateTo(int flush);
+
+    QIODevice *m_device;
+    z_stream m_stream;
+    bool m_valid = false;
+};
+
+#endif // GZIPWRITER_H
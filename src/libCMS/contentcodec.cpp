@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+
+#include "contentcodec.h"
+
+#include <QtEndian>
+#include <QDebug>
+
+#include <zlib.h>
+
+using namespace CMS;
+
+// Later bytes are cheaper to refer to, so the most common go last
+static const char s_dictionary1[] =
+        "<table><tbody><tr><td></td></tr></tbody></table>"
+        "<pre><code></code></pre><blockquote></blockquote>"
+        "<h1></h1><h4></h4><hr /><br />"
+        "<span style=\"text-decoration: underline;\"></span>"
+        "<p style=\"text-align: center;\"></p><p style=\"text-align: right;\"></p>"
+        "<iframe src=\"https://www.youtube.com/embed/\" width=\"560\" height=\"315\" frameborder=\"0\" allowfullscreen=\"allowfullscreen\"></iframe>"
+        "<img class=\"aligncenter\" src=\"/.media/\" alt=\"\" width=\"\" height=\"\" />"
+        " target=\"_blank\" rel=\"noopener\""
+        "<ol><li></li></ol>"
+        "<h3></h3><h2></h2>"
+        "<ul>\n<li></li>\n</ul>\n"
+        "<em></em><strong></strong>"
+        "<a href=\"https://\"></a><a href=\"http://\"></a>"
+        "&nbsp;</p>\n<p>the and of to in is that for with on this are it as be you can by from at "
+        "</p>\n<p>";
+
+// Format byte, size of the text, raw deflate
+#define CODEC_DICTIONARY_1 0x01
+#define CODEC_HEADER_SIZE 5
+
+QByteArray ContentCodec::compress(const QString &text)
+{
+    const QByteArray utf8 = text.toUtf8();
+
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        qWarning() << "Failed to initialize content compression" << stream.msg;
+        return QByteArray();
+    }
+
+    deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(s_dictionary1), sizeof(s_dictionary1) - 1);
+
+    QByteArray ret(CODEC_HEADER_SIZE + int(deflateBound(&stream, uLong(utf8.size()))), Qt::Uninitialized);
+    ret[0] = char(CODEC_DICTIONARY_1);
+    qToBigEndian<quint32>(quint32(utf8.size()), reinterpret_cast<uchar *>(ret.data() + 1));
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(utf8.constData()));
+    stream.avail_in = uInt(utf8.size());
+    stream.next_out = reinterpret_cast<Bytef *>(ret.data() + CODEC_HEADER_SIZE);
+    stream.avail_out = uInt(ret.size() - CODEC_HEADER_SIZE);
+    const int status = deflate(&stream, Z_FINISH);
+    const int size = CODEC_HEADER_SIZE + int(stream.total_out);
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END || size >= utf8.size()) {
+        return QByteArray();
+    }
+
+    ret.resize(size);
+    return ret;
+}
+
+QString ContentCodec::decompress(const QByteArray &data)
+{
+    if (data.size() < CODEC_HEADER_SIZE || data.at(0) != char(CODEC_DICTIONARY_1)) {
+        qWarning() << "Unknown compressed content format";
+        return QString();
+    }
+
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.next_in = Z_NULL;
+    stream.avail_in = 0;
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        qWarning() << "Failed to initialize content decompression" << stream.msg;
+        return QString();
+    }
+
+    inflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(s_dictionary1), sizeof(s_dictionary1) - 1);
+
+    QByteArray utf8(int(qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(data.constData() + 1))), Qt::Uninitialized);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData() + CODEC_HEADER_SIZE));
+    stream.avail_in = uInt(data.size() - CODEC_HEADER_SIZE);
+    stream.next_out = reinterpret_cast<Bytef *>(utf8.data());
+    stream.avail_out = uInt(utf8.size());
+    const int status = inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END || stream.total_out != uLong(utf8.size())) {
+        qWarning() << "Failed to decompress content" << status;
+        return QString();
+    }
+
+    return QString::fromUtf8(utf8);
+}
+
+QString ContentCodec::content(const QVariant &text, const QVariant &compressed)
+{
+    if (text.isNull() && !compressed.isNull()) {
+        return decompress(compressed.toByteArray());
+    }
+    return text.toString();
+}
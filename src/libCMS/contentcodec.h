@@ -0,0 +1,53 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+
+#ifndef CONTENTCODEC_H
+#define CONTENTCODEC_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+
+namespace CMS {
+
+/**
+ * Compression of post bodies, deflate primed with a dictionary of
+ * the markup the editor produces so even short bodies shrink
+ */
+class ContentCodec
+{
+public:
+    /**
+     * Returns the compressed text, starting with a byte naming the
+     * dictionary and the size of the text, or an empty array if
+     * compressing doesn't make it smaller
+     */
+    static QByteArray compress(const QString &text);
+    static QString decompress(const QByteArray &data);
+
+    /**
+     * The body from a row, stored either as text or compressed
+     */
+    static QString content(const QVariant &text, const QVariant &compressed);
+};
+
+}
+
+#endif // CONTENTCODEC_H
@@ -18,9 +18,12 @@
  ***************************************************************************/
 
 #include "engine.h"
+#include "engine_p.h"
 #include "menu.h"
 #include "page.h"
 
+#include <Cutelyst/Context>
+
 #include <QRegularExpression>
 #include <QStringList>
 #include <QDateTime>
@@ -29,13 +32,14 @@
 using namespace CMS;
 
 Engine::Engine(QObject *parent) : QObject(parent)
+  , d_ptr(new EnginePrivate)
 {
 
 }
 
 Engine::~Engine()
 {
-
+    delete d_ptr;
 }
 
 int Engine::savePage(Cutelyst::Context *c, Page *page)
@@ -92,11 +96,107 @@ bool Engine::saveMenus(Cutelyst::Context *c, const QList<Menu *> &menus)
     return true;
 }
 
+bool Engine::warmUp(Cutelyst::Application *app)
+{
+    Q_UNUSED(app)
+    setReady(true);
+    return true;
+}
+
+bool Engine::isReady() const
+{
+    Q_D(const Engine);
+    return d->ready;
+}
+
+void Engine::setReady(bool ready)
+{
+    Q_D(Engine);
+    d->ready = ready;
+}
+
+bool Engine::hasPublishedPath(const QString &path)
+{
+    Q_UNUSED(path)
+    return true;
+}
+
+void Engine::addDependency(Cutelyst::Context *c, const QString &entity)
+{
+    QStringList deps = c->property("_cms_deps").toStringList();
+    if (!deps.contains(entity)) {
+        deps.append(entity);
+        c->setProperty("_cms_deps", deps);
+    }
+}
+
+void Engine::addDependencies(Cutelyst::Context *c, const QStringList &entities)
+{
+    QStringList deps = c->property("_cms_deps").toStringList();
+    for (const QString &entity : entities) {
+        if (!deps.contains(entity)) {
+            deps.append(entity);
+        }
+    }
+    c->setProperty("_cms_deps", deps);
+}
+
+QStringList Engine::dependencies(Cutelyst::Context *c)
+{
+    QStringList deps = c->property("_cms_deps").toStringList();
+    deps.sort();
+    return deps;
+}
+
+void Engine::recordOutput(const QString &output, const QStringList &dependencies)
+{
+    Q_UNUSED(output)
+    Q_UNUSED(dependencies)
+}
+
+bool Engine::flushOutputs()
+{
+    return true;
+}
+
 QDateTime Engine::lastModified()
 {
     return QDateTime();
 }
 
+QTimeZone Engine::timeZone() const
+{
+    return QTimeZone::systemTimeZone();
+}
+
+QVariantList Engine::revisions(int pageId)
+{
+    Q_UNUSED(pageId)
+    return QVariantList();
+}
+
+bool Engine::revision(int pageId, int revision, QString *title, QString *content)
+{
+    Q_UNUSED(pageId)
+    Q_UNUSED(revision)
+    Q_UNUSED(title)
+    Q_UNUSED(content)
+    return false;
+}
+
+bool Engine::backup(const QString &destination, bool compress)
+{
+    Q_UNUSED(destination)
+    Q_UNUSED(compress)
+    return false;
+}
+
+bool Engine::restore(const QString &source)
+{
+    Q_UNUSED(source)
+    return false;
+}
+
 QVariant Engine::settingsProperty()
 {
     return QVariant::fromValue(settings());
@@ -113,6 +213,26 @@ QString Engine::normalizePath(const QString &path)
     return parts.join(QLatin1Char('/'));
 }
 
+QDateTime Engine::fromSqlDateTime(const QVariant &value)
+{
+    QDateTime ret;
+    if (value.type() == QVariant::DateTime) {
+        ret = value.toDateTime();
+    } else {
+        ret = QDateTime::fromString(value.toString(), QStringLiteral("yyyy-MM-dd HH:mm:ss"));
+    }
+    ret.setTimeSpec(Qt::UTC);
+    return ret;
+}
+
+QVariant Engine::toSqlDateTime(const QDateTime &dateTime)
+{
+    if (dateTime.isValid()) {
+        return dateTime.toUTC().toString(QStringLiteral("yyyy-MM-dd HH:mm:ss"));
+    }
+    return QVariant();
+}
+
 QString Engine::normalizeTitle(const QString &title)
 {
     // "Iam a big/small...path" turns into
@@ -22,18 +22,24 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QDateTime>
+#include <QTimeZone>
 #include <QHash>
+#include <QStringList>
 
 #include <Cutelyst/ParamsMultiMap>
 
 namespace Cutelyst {
 class Context;
+class Application;
 }
 
 namespace CMS {
 
 class Page;
 class Menu;
+class SiteContext;
+class FragmentCache;
 class EnginePrivate;
 class Engine : public QObject
 {
@@ -108,6 +114,21 @@ public:
 
     virtual QDateTime lastModified();
 
+    /**
+     * Time zone dates are shown and entered in
+     */
+    virtual QTimeZone timeZone() const;
+
+    /**
+     * Saved versions of a page, newest first
+     */
+    virtual QVariantList revisions(int pageId);
+
+    /**
+     * Title and content of a page as it was saved on revision
+     */
+    virtual bool revision(int pageId, int revision, QString *title, QString *content);
+
     virtual bool settingsIsWritable() const = 0;
     virtual QHash<QString, QString> settings() const = 0;
     virtual QVariant settingsProperty();
@@ -117,8 +138,62 @@ public:
     static QString normalizePath(const QString &path);
     static QString normalizeTitle(const QString &path);
 
+    /**
+     * Converts a UTC date time column, which might come as a
+     * "yyyy-MM-dd HH:mm:ss" string or a native timestamp
+     */
+    static QDateTime fromSqlDateTime(const QVariant &value);
+    static QVariant toSqlDateTime(const QDateTime &dateTime);
+
     virtual QHash<QString, QString> loadSettings(Cutelyst::Context *c) = 0;
 
+    /**
+     * Loads settings, menus, users and anything else
+     * requests need before the first one arrives
+     */
+    virtual bool warmUp(Cutelyst::Application *app);
+
+    /**
+     * True once the engine caches are loaded
+     */
+    bool isReady() const;
+
+    /**
+     * Returns false when path is known not to be a published page
+     */
+    virtual bool hasPublishedPath(const QString &path);
+
+    /**
+     * Records that the output being rendered for c read entity,
+     * like "post:<id>", "author:<id>", "posts" or "setting:<key>"
+     */
+    static void addDependency(Cutelyst::Context *c, const QString &entity);
+    static void addDependencies(Cutelyst::Context *c, const QStringList &entities);
+    static QStringList dependencies(Cutelyst::Context *c);
+
+    /**
+     * Stores which entities output was rendered from, so changing
+     * one of them only invalidates the outputs that read it
+     */
+    virtual void recordOutput(const QString &output, const QStringList &dependencies);
+
+    /**
+     * Stores recorded dependencies now instead of batching
+     * them, returns false if they could not be stored
+     */
+    virtual bool flushOutputs();
+
+    /**
+     * Values derived from the current settings, the
+     * returned object is replaced when settings change
+     */
+    virtual SiteContext *siteContext() = 0;
+
+    /**
+     * Rendered fragments valid for the current settings generation
+     */
+    virtual FragmentCache *fragmentCache() = 0;
+
     /**
      * returns slug
      */
@@ -130,9 +205,46 @@ public:
     virtual QHash<QString, QString> user(const QString &slug) = 0;
     virtual QHash<QString, QString> user(int id) = 0;
 
+    /**
+     * Writes a consistent copy of the database into destination
+     * without stopping writers, returns false if not supported
+     */
+    virtual bool backup(const QString &destination, bool compress);
+
+    /**
+     * Replaces the current database with the contents of source
+     */
+    virtual bool restore(const QString &source);
+
+Q_SIGNALS:
+    /**
+     * Emitted when outputs became stale, either by changes made
+     * on this engine or seen when loading a new generation
+     */
+    void outputsInvalidated(const QStringList &outputs);
+
+    /**
+     * Emitted only by the engine that made the change, with the
+     * entities that changed and the outputs that depended on them
+     */
+    void contentChanged(const QStringList &entities, const QStringList &outputs);
+
+    /**
+     * Emitted by the engine making a change as soon as the new
+     * generation starts, before outputs depending on it are looked up
+     */
+    void generationStarted(qint64 generation);
+
+    /**
+     * Emitted when the theme setting is first loaded and when it changes
+     */
+    void themeChanged(const QString &theme);
+
 protected:
     virtual int savePageBackend(Page *page) = 0;
 
+    void setReady(bool ready);
+
     EnginePrivate *d_ptr;
 };
 
@@ -31,6 +31,7 @@ class EnginePrivate
 {
 public:
     QHash<QString, Page*> pages;
+    bool ready = false;
 };
 
 }
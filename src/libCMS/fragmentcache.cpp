@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "fragmentcache.h"
+
+using namespace CMS;
+
+FragmentCache::FragmentCache()
+{
+    m_cache.setMaxCost(4 * 1024 * 1024);
+}
+
+int FragmentCache::maxSize() const
+{
+    return m_cache.maxCost();
+}
+
+void FragmentCache::setMaxSize(int bytes)
+{
+    m_cache.setMaxCost(bytes);
+}
+
+QString FragmentCache::value(const QString &key) const
+{
+    QString *fragment = m_cache.object(key);
+    if (fragment) {
+        return *fragment;
+    }
+    return QString();
+}
+
+void FragmentCache::insert(const QString &key, const QString &fragment)
+{
+    // A null string means not cached, so store empty fragments as empty
+    const int cost = (key.size() + fragment.size()) * int(sizeof(QChar));
+    m_cache.insert(key, new QString(fragment.isNull() ? QStringLiteral("") : fragment), cost);
+}
+
+void FragmentCache::clear()
+{
+    m_cache.clear();
+}
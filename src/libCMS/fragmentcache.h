@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef FRAGMENTCACHE_H
+#define FRAGMENTCACHE_H
+
+#include <QCache>
+#include <QString>
+
+namespace CMS {
+
+/**
+ * Rendered template fragments, the engine clears it
+ * when a new settings generation is loaded so entries
+ * never outlive the content they were rendered from
+ */
+class FragmentCache
+{
+public:
+    FragmentCache();
+
+    /**
+     * Maximum size in bytes of all cached fragments
+     */
+    int maxSize() const;
+    void setMaxSize(int bytes);
+
+    /**
+     * Returns the fragment or a null string if it's not cached
+     */
+    QString value(const QString &key) const;
+    void insert(const QString &key, const QString &fragment);
+
+    void clear();
+
+private:
+    QCache<QString, QString> m_cache;
+};
+
+}
+
+#endif // FRAGMENTCACHE_H
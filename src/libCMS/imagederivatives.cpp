@@ -0,0 +1,176 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "imagederivatives.h"
+
+#include "mediastore.h"
+#include "jobscheduler.h"
+
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#include <algorithm>
+
+using namespace CMS;
+
+Q_GLOBAL_STATIC(ImageDerivatives, globalImageDerivatives)
+
+ImageDerivatives::ImageDerivatives()
+{
+
+}
+
+ImageDerivatives *ImageDerivatives::instance()
+{
+    return globalImageDerivatives();
+}
+
+void ImageDerivatives::configure(const QString &root, const QVector<int> &widths, const QList<QByteArray> &formats, int quality)
+{
+    m_root = root;
+    m_widths = widths;
+    std::sort(m_widths.begin(), m_widths.end());
+    m_quality = quality;
+
+    const QList<QByteArray> supported = QImageWriter::supportedImageFormats();
+    m_formats.clear();
+    for (const QByteArray &format : formats) {
+        if (supported.contains(format)) {
+            m_formats.append(format);
+        } else {
+            qDebug() << "Image format not supported, skipping derivatives" << format;
+        }
+    }
+}
+
+bool ImageDerivatives::isEnabled() const
+{
+    return !m_root.isEmpty() && !m_widths.isEmpty();
+}
+
+QVector<int> ImageDerivatives::widths() const
+{
+    return m_widths;
+}
+
+void ImageDerivatives::enqueue(const QString &hash)
+{
+    if (isEnabled()) {
+        JobScheduler::enqueue(QStringLiteral("media-derivatives"), { {QStringLiteral("hash"), hash} });
+    }
+}
+
+QString ImageDerivatives::path(const QString &hash, int width, const QString &format) const
+{
+    return MediaStore(m_root).derivativesPath(hash) + QLatin1Char('/') + QString::number(width) + QLatin1Char('.') + format;
+}
+
+QString ImageDerivatives::srcset(const QString &url, const QString &format) const
+{
+    const QString hash = ImageDerivatives::hash(url);
+    if (!isEnabled() || hash.isEmpty()) {
+        return QString();
+    }
+
+    const QFileInfo name(url.section(QLatin1Char('/'), 3));
+    QString suffix = format.isEmpty() ? name.suffix().toLower() : format;
+    if (suffix == QLatin1String("jpeg")) {
+        suffix = QStringLiteral("jpg");
+    }
+
+    QStringList ret;
+    for (int width : m_widths) {
+        if (QFile::exists(path(hash, width, suffix))) {
+            ret.append(QLatin1String("/.media/") + hash + QLatin1String("/w") + QString::number(width) +
+                       QLatin1Char('/') + name.completeBaseName() + QLatin1Char('.') + suffix +
+                       QLatin1Char(' ') + QString::number(width) + QLatin1Char('w'));
+        }
+    }
+    return ret.join(QLatin1String(", "));
+}
+
+QString ImageDerivatives::hash(const QString &url)
+{
+    // /.media/<hash>/<name>
+    const QStringList parts = url.split(QLatin1Char('/'));
+    if (parts.size() != 4 || parts.at(1) != QLatin1String(".media") || !MediaStore::isHash(parts.at(2))) {
+        return QString();
+    }
+    return parts.at(2);
+}
+
+bool ImageDerivatives::generate(const QString &hash, QString *error) const
+{
+    const QString blob = MediaStore(m_root).blobPath(hash);
+
+    QImageReader probe(blob);
+    const QByteArray original = probe.format();
+    const QSize size = probe.size();
+    // Animations would lose their frames
+    if (original.isEmpty() || !size.isValid() || probe.supportsAnimation()) {
+        return true;
+    }
+
+    bool ok = true;
+    QList<QByteArray> formats = m_formats;
+    formats.prepend(original == "jpg" ? QByteArrayLiteral("jpeg") : original);
+
+    for (int width : m_widths) {
+        if (width >= size.width()) {
+            break;
+        }
+
+        // Decoding straight to the target size is much cheaper than scaling after
+        QImageReader reader(blob);
+        reader.setScaledSize(QSize(width, qMax(1, size.height() * width / size.width())));
+        const QImage image = reader.read();
+        if (image.isNull()) {
+            *error = QLatin1String("Failed to read image ") + blob + QLatin1String(": ") + reader.errorString();
+            return false;
+        }
+
+        for (const QByteArray &format : formats) {
+            const QString file = path(hash, width, QString::fromLatin1(format == "jpeg" ? QByteArrayLiteral("jpg") : format));
+            if (QFile::exists(file)) {
+                continue;
+            }
+
+            QDir().mkpath(QFileInfo(file).absolutePath());
+            QSaveFile out(file);
+            if (!out.open(QIODevice::WriteOnly)) {
+                *error = QLatin1String("Failed to write image derivative ") + file + QLatin1String(": ") + out.errorString();
+                ok = false;
+                continue;
+            }
+
+            QImageWriter writer(&out, format);
+            writer.setQuality(m_quality);
+            if (!writer.write(image) || !out.commit()) {
+                *error = QLatin1String("Failed to write image derivative ") + file + QLatin1String(": ") + writer.errorString();
+                ok = false;
+            }
+        }
+    }
+
+    return ok;
+}
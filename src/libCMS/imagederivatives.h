@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef IMAGEDERIVATIVES_H
+#define IMAGEDERIVATIVES_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QList>
+
+namespace CMS {
+
+/**
+ * Smaller copies of uploaded images in their own format and in
+ * the modern ones Qt can write (WebP, AVIF), generated by the
+ * media-derivatives job and stored next to the blobs as
+ * derivatives/ab/cd/<hash>/<width>.<format>
+ */
+class ImageDerivatives
+{
+public:
+    ImageDerivatives();
+
+    static ImageDerivatives *instance();
+
+    /**
+     * root is the media directory, widths the sizes to generate
+     * and formats the extra ones to convert to if supported
+     */
+    void configure(const QString &root, const QVector<int> &widths, const QList<QByteArray> &formats, int quality);
+    bool isEnabled() const;
+
+    QVector<int> widths() const;
+
+    /**
+     * Schedules the derivatives of an image blob
+     */
+    void enqueue(const QString &hash);
+
+    /**
+     * Writes the missing derivatives of an image blob,
+     * returns false if some could not be written
+     */
+    bool generate(const QString &hash, QString *error) const;
+
+    QString path(const QString &hash, int width, const QString &format) const;
+
+    /**
+     * Returns the srcset entries for a /.media/<hash>/<name> url,
+     * in format or the original one if empty, of the derivatives
+     * already generated
+     */
+    QString srcset(const QString &url, const QString &format = QString()) const;
+
+    /**
+     * Returns the blob hash of a /.media/<hash>/<name> url,
+     * empty for any other
+     */
+    static QString hash(const QString &url);
+
+private:
+    QString m_root;
+    QVector<int> m_widths;
+    QList<QByteArray> m_formats;
+    int m_quality = 80;
+};
+
+}
+
+#endif // IMAGEDERIVATIVES_H
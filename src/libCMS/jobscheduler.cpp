@@ -0,0 +1,421 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+
+#include "jobscheduler.h"
+#include "engine.h"
+
+#include <Cutelyst/Plugins/Utils/Sql>
+
+#include <QThread>
+#include <QTimer>
+#include <QFile>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QJsonDocument>
+#include <QAtomicPointer>
+#include <QDebug>
+
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+using namespace CMS;
+
+static QAtomicPointer<JobScheduler> s_running;
+
+namespace CMS {
+
+class JobWorker : public QThread
+{
+public:
+    JobWorker(JobScheduler *scheduler) : m_scheduler(scheduler) { }
+
+protected:
+    virtual void run() override
+    {
+        m_scheduler->work();
+    }
+
+private:
+    JobScheduler *m_scheduler;
+};
+
+}
+
+static qint64 currentSecs()
+{
+    return QDateTime::currentMSecsSinceEpoch() / 1000;
+}
+
+JobScheduler::JobScheduler(QObject *parent) : QObject(parent)
+{
+
+}
+
+JobScheduler::~JobScheduler()
+{
+    stop();
+}
+
+void JobScheduler::registerHandler(const QString &type, Handler handler, QObject *context)
+{
+    m_handlers.insert(type, { handler, context, context != nullptr });
+}
+
+void JobScheduler::setMaxAttempts(int attempts)
+{
+    m_maxAttempts = qMax(1, attempts);
+}
+
+void JobScheduler::setBackoff(int seconds)
+{
+    m_backoff = qMax(1, seconds);
+}
+
+void JobScheduler::setPollInterval(int msecs)
+{
+    m_pollInterval = qMax(100, msecs);
+}
+
+void JobScheduler::start(const QString &lockPath, int threads)
+{
+    m_lockPath = lockPath;
+    m_threads = qMax(1, threads);
+
+    // Workers open connections like the ones of this thread
+    m_connections.clear();
+    for (const QString &name : { QStringLiteral("cmlyst"), QStringLiteral("cmlyst_ro") }) {
+        const QString connection = Cutelyst::Sql::databaseNameThread(name);
+        if (!QSqlDatabase::contains(connection)) {
+            continue;
+        }
+
+        const QSqlDatabase db = QSqlDatabase::database(connection, false);
+        m_connections.append({
+                                 name,
+                                 db.driverName(),
+                                 db.databaseName(),
+                                 db.hostName(),
+                                 db.port(),
+                                 db.userName(),
+                                 db.password(),
+                                 db.connectOptions()
+                             });
+    }
+
+    if (!m_lockTimer) {
+        m_lockTimer = new QTimer(this);
+        m_lockTimer->setInterval(30000);
+        connect(m_lockTimer, &QTimer::timeout, this, &JobScheduler::tryLock);
+    }
+    m_lockTimer->start();
+    tryLock();
+}
+
+void JobScheduler::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_wake.wakeAll();
+    }
+    s_running.testAndSetOrdered(this, nullptr);
+
+    for (QThread *worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+    m_workers.clear();
+
+    if (m_lockTimer) {
+        m_lockTimer->stop();
+    }
+
+    if (m_lockFd != -1) {
+        ::close(m_lockFd);
+        m_lockFd = -1;
+    }
+}
+
+bool JobScheduler::isRunning() const
+{
+    return !m_workers.isEmpty();
+}
+
+bool JobScheduler::enqueue(const QString &type, const QJsonObject &payload, int priority, const QDateTime &runAt, const QString &key)
+{
+    const qint64 at = runAt.isValid() ? runAt.toMSecsSinceEpoch() / 1000 : currentSecs();
+    const QString json = QString::fromUtf8(QJsonDocument(payload).toJson(QJsonDocument::Compact));
+
+    bool replaced = false;
+    if (!key.isEmpty()) {
+        QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE jobs "
+                                                                      "SET type = :type, payload = :payload, priority = :priority "
+                                                                      ", run_at = :run_at, attempts = 0 "
+                                                                      "WHERE unique_key = :key AND status = 'pending'"),
+                                                       QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":type"), type);
+        query.bindValue(QStringLiteral(":payload"), json);
+        query.bindValue(QStringLiteral(":priority"), priority);
+        query.bindValue(QStringLiteral(":run_at"), at);
+        query.bindValue(QStringLiteral(":key"), key);
+        if (!query.exec()) {
+            qWarning() << "Failed to enqueue job" << type << query.lastError().databaseText();
+            return false;
+        }
+        replaced = query.numRowsAffected() > 0;
+    }
+
+    if (!replaced) {
+        QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO jobs "
+                                                                      "(type, payload, unique_key, priority, status, attempts, run_at, created_at) "
+                                                                      "VALUES "
+                                                                      "(:type, :payload, :key, :priority, 'pending', 0, :run_at, :created_at)"),
+                                                       QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":type"), type);
+        query.bindValue(QStringLiteral(":payload"), json);
+        query.bindValue(QStringLiteral(":key"), key.isEmpty() ? QVariant(QVariant::String) : key);
+        query.bindValue(QStringLiteral(":priority"), priority);
+        query.bindValue(QStringLiteral(":run_at"), at);
+        query.bindValue(QStringLiteral(":created_at"), Engine::toSqlDateTime(QDateTime::currentDateTimeUtc()));
+        if (!query.exec()) {
+            qWarning() << "Failed to enqueue job" << type << query.lastError().databaseText();
+            return false;
+        }
+    }
+
+    // Other processes find it on their next poll
+    JobScheduler *running = s_running.loadAcquire();
+    if (running) {
+        running->wake();
+    }
+    return true;
+}
+
+void JobScheduler::tryLock()
+{
+    if (m_lockFd == -1) {
+        m_lockFd = ::open(QFile::encodeName(m_lockPath).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (m_lockFd == -1) {
+            qCritical() << "Failed to open job lock" << m_lockPath << strerror(errno);
+            m_lockTimer->stop();
+            return;
+        }
+    }
+
+    if (flock(m_lockFd, LOCK_EX | LOCK_NB) == -1) {
+        return;
+    }
+    m_lockTimer->stop();
+
+    // Whoever held the lock before exited while running these
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE jobs SET status = 'pending' WHERE status = 'running'"),
+                                                   QStringLiteral("cmlyst"));
+    if (!query.exec()) {
+        qWarning() << "Failed to requeue interrupted jobs" << query.lastError().databaseText();
+    }
+
+    m_stopping = false;
+    for (int i = 0; i < m_threads; ++i) {
+        auto worker = new JobWorker(this);
+        worker->setObjectName(QStringLiteral("cmlyst-job-%1").arg(i));
+        worker->start(QThread::LowPriority);
+        m_workers.append(worker);
+    }
+    s_running.storeRelease(this);
+    qDebug() << "Running jobs with" << m_threads << "threads";
+}
+
+void JobScheduler::work()
+{
+    for (const Connection &connection : m_connections) {
+        QSqlDatabase db = QSqlDatabase::addDatabase(connection.driver, Cutelyst::Sql::databaseNameThread(connection.name));
+        db.setDatabaseName(connection.database);
+        db.setHostName(connection.host);
+        db.setPort(connection.port);
+        db.setUserName(connection.user);
+        db.setPassword(connection.password);
+
+        QString options = connection.options;
+        if (connection.driver == QLatin1String("QSQLITE") && !options.contains(QLatin1String("QSQLITE_BUSY_TIMEOUT"))) {
+            options += (options.isEmpty() ? QString() : QStringLiteral(";")) + QLatin1String("QSQLITE_BUSY_TIMEOUT=5000");
+        }
+        db.setConnectOptions(options);
+
+        if (!db.open()) {
+            qCritical() << "Job worker failed to open database" << connection.name << db.lastError().databaseText();
+            return;
+        }
+    }
+
+    Q_FOREVER {
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_stopping) {
+                break;
+            }
+        }
+
+        Job job;
+        qint64 nextRun = -1;
+        if (claim(&job, &nextRun)) {
+            QString error;
+            const bool ok = execute(job, &error);
+            if (!ok) {
+                qWarning() << "Job failed" << job.id << job.type << "attempt" << job.attempts << error;
+            }
+            finish(job, ok, error);
+            continue;
+        }
+
+        qint64 wait = m_pollInterval;
+        if (nextRun >= 0) {
+            wait = qBound(Q_INT64_C(100), (nextRun - currentSecs()) * 1000, qint64(m_pollInterval));
+        }
+
+        QMutexLocker locker(&m_mutex);
+        if (!m_stopping) {
+            m_wake.wait(&m_mutex, static_cast<unsigned long>(wait));
+        }
+    }
+}
+
+bool JobScheduler::claim(Job *job, qint64 *nextRun)
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, type, payload, attempts FROM jobs "
+                                                                  "WHERE status = 'pending' AND run_at <= :now "
+                                                                  "ORDER BY priority DESC, run_at, id "
+                                                                  "LIMIT 1"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":now"), currentSecs());
+
+    // Other workers may take the same job first
+    while (query.exec() && query.next()) {
+        job->id = query.value(0).toLongLong();
+        job->type = query.value(1).toString();
+        job->payload = QJsonDocument::fromJson(query.value(2).toString().toUtf8()).object();
+        job->attempts = query.value(3).toInt() + 1;
+        query.finish();
+
+        QSqlQuery update = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE jobs "
+                                                                       "SET status = 'running', attempts = attempts + 1 "
+                                                                       "WHERE id = :id AND status = 'pending'"),
+                                                        QStringLiteral("cmlyst"));
+        update.bindValue(QStringLiteral(":id"), job->id);
+        if (!update.exec()) {
+            qWarning() << "Failed to claim job" << job->id << update.lastError().databaseText();
+            return false;
+        }
+
+        if (update.numRowsAffected() == 1) {
+            return true;
+        }
+    }
+
+    QSqlQuery next = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT min(run_at) FROM jobs WHERE status = 'pending'"),
+                                                  QStringLiteral("cmlyst"));
+    if (next.exec() && next.next() && !next.value(0).isNull()) {
+        *nextRun = next.value(0).toLongLong();
+    }
+    return false;
+}
+
+bool JobScheduler::execute(const Job &job, QString *error)
+{
+    auto it = m_handlers.constFind(job.type);
+    if (it == m_handlers.constEnd()) {
+        *error = QStringLiteral("No handler for job type");
+        return false;
+    }
+
+    if (!it->hasContext) {
+        return it->handler(job.payload, error);
+    }
+
+    QObject *context = it->context.data();
+    if (!context) {
+        *error = QStringLiteral("Job handler context is gone");
+        return false;
+    }
+
+    struct Call {
+        QSemaphore done;
+        bool ok = false;
+        QString error;
+    };
+    QSharedPointer<Call> call(new Call);
+    const Handler handler = it->handler;
+    const QJsonObject payload = job.payload;
+    QTimer::singleShot(0, context, [call, handler, payload] {
+        call->ok = handler(payload, &call->error);
+        call->done.release();
+    });
+
+    // Don't hold shutdown waiting on a thread that may be gone
+    while (!call->done.tryAcquire(1, 100)) {
+        QMutexLocker locker(&m_mutex);
+        if (m_stopping) {
+            *error = QStringLiteral("Interrupted");
+            return false;
+        }
+    }
+
+    *error = call->error;
+    return call->ok;
+}
+
+void JobScheduler::finish(const Job &job, bool ok, const QString &error)
+{
+    QSqlQuery query;
+    if (ok) {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM jobs WHERE id = :id"),
+                                             QStringLiteral("cmlyst"));
+    } else if (job.attempts >= m_maxAttempts || !m_handlers.contains(job.type)) {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE jobs "
+                                                            "SET status = 'failed', last_error = :error "
+                                                            "WHERE id = :id"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":error"), error);
+    } else {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE jobs "
+                                                            "SET status = 'pending', run_at = :run_at, last_error = :error "
+                                                            "WHERE id = :id"),
+                                             QStringLiteral("cmlyst"));
+        const qint64 backoff = qMin(Q_INT64_C(3600), qint64(m_backoff) << qMin(job.attempts - 1, 16));
+        query.bindValue(QStringLiteral(":run_at"), currentSecs() + backoff);
+        query.bindValue(QStringLiteral(":error"), error);
+    }
+    query.bindValue(QStringLiteral(":id"), job.id);
+
+    if (!query.exec()) {
+        qWarning() << "Failed to finish job" << job.id << query.lastError().databaseText();
+    }
+}
+
+void JobScheduler::wake()
+{
+    QMutexLocker locker(&m_mutex);
+    m_wake.wakeAll();
+}
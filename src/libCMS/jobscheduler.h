@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QPointer>
+#include <QDateTime>
+#include <QVector>
+
+#include <functional>
+
+class QThread;
+class QTimer;
+
+namespace CMS {
+
+/**
+ * Deferred work stored in the jobs table, any process can enqueue
+ * but only the one holding the lock file runs them, on its own
+ * threads with their own database connections, highest priority
+ * first and retried with exponential backoff when they fail
+ */
+class JobScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * Returns false and sets error on failure,
+     * handlers should be safe to run twice
+     */
+    typedef std::function<bool(const QJsonObject &payload, QString *error)> Handler;
+
+    explicit JobScheduler(QObject *parent = nullptr);
+    ~JobScheduler();
+
+    /**
+     * Handlers run on the worker threads, or on the thread of
+     * context if given, they must be registered before start()
+     */
+    void registerHandler(const QString &type, Handler handler, QObject *context = nullptr);
+
+    void setMaxAttempts(int attempts);
+    void setBackoff(int seconds);
+    void setPollInterval(int msecs);
+
+    /**
+     * Tries to become the process running jobs, retrying while
+     * another one holds lockPath in case it goes away
+     */
+    void start(const QString &lockPath, int threads);
+    void stop();
+
+    bool isRunning() const;
+
+    /**
+     * Adds a job to run at runAt, or as soon as possible, a non empty
+     * key replaces the pending job with the same key instead
+     */
+    static bool enqueue(const QString &type,
+                        const QJsonObject &payload = QJsonObject(),
+                        int priority = 0,
+                        const QDateTime &runAt = QDateTime(),
+                        const QString &key = QString());
+
+private:
+    struct Job {
+        qint64 id;
+        QString type;
+        QJsonObject payload;
+        int attempts;
+    };
+
+    struct Connection {
+        QString name;
+        QString driver;
+        QString database;
+        QString host;
+        int port;
+        QString user;
+        QString password;
+        QString options;
+    };
+
+    void tryLock();
+    void work();
+    bool claim(Job *job, qint64 *nextRun);
+    bool execute(const Job &job, QString *error);
+    void finish(const Job &job, bool ok, const QString &error);
+    void wake();
+
+    friend class JobWorker;
+
+    struct Registration {
+        Handler handler;
+        QPointer<QObject> context;
+        bool hasContext;
+    };
+    QHash<QString, Registration> m_handlers;
+    QVector<Connection> m_connections;
+    QVector<QThread *> m_workers;
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    QString m_lockPath;
+    QTimer *m_lockTimer = nullptr;
+    int m_lockFd = -1;
+    int m_threads = 1;
+    int m_maxAttempts = 5;
+    int m_backoff = 30;
+    int m_pollInterval = 5000;
+    bool m_stopping = false;
+};
+
+}
+
+#endif // JOBSCHEDULER_H
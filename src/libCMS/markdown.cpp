@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "markdown.h"
+
+#include "config.h"
+
+#ifdef HAVE_CMARK
+#include <cmark.h>
+#endif
+
+#include <cstdlib>
+
+using namespace CMS;
+
+bool Markdown::isAvailable()
+{
+#ifdef HAVE_CMARK
+    return true;
+#else
+    return false;
+#endif
+}
+
+QString Markdown::toHtml(const QString &text)
+{
+#ifdef HAVE_CMARK
+    int options = CMARK_OPT_DEFAULT;
+#ifdef CMARK_OPT_UNSAFE
+    // cmark >= 0.29 drops raw HTML unless told otherwise
+    options |= CMARK_OPT_UNSAFE;
+#endif
+    const QByteArray utf8 = text.toUtf8();
+    char *html = cmark_markdown_to_html(utf8.constData(), size_t(utf8.size()), options);
+    const QString ret = QString::fromUtf8(html);
+    free(html);
+    return ret;
+#else
+    // Still readable without a renderer
+    return QLatin1String("<pre>") + text.toHtmlEscaped() + QLatin1String("</pre>");
+#endif
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef MARKDOWN_H
+#define MARKDOWN_H
+
+#include <QString>
+
+namespace CMS {
+
+/**
+ * CommonMark to HTML, done once when a post is saved
+ */
+class Markdown
+{
+public:
+    /**
+     * Whether CMlyst was built with cmark
+     */
+    static bool isAvailable();
+
+    /**
+     * Raw HTML in the text is kept, authors are trusted
+     */
+    static QString toHtml(const QString &text);
+};
+
+}
+
+#endif // MARKDOWN_H
@@ -0,0 +1,553 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "mediastore.h"
+
+#include "engine.h"
+#include "imagederivatives.h"
+
+#include <Cutelyst/Plugins/Utils/Sql>
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QCryptographicHash>
+#include <QMimeDatabase>
+#include <QImageReader>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFile>
+#include <QSet>
+#include <QUuid>
+#include <QDebug>
+
+#include <limits>
+
+#include <unistd.h>
+
+using namespace CMS;
+
+MediaStore::MediaStore(const QString &root) : m_root(root)
+{
+
+}
+
+QString MediaStore::root() const
+{
+    return m_root.absolutePath();
+}
+
+bool MediaStore::isHash(const QString &hash)
+{
+    if (hash.size() != 64) {
+        return false;
+    }
+
+    for (const QChar &ch : hash) {
+        if (!((ch >= QLatin1Char('0') && ch <= QLatin1Char('9')) || (ch >= QLatin1Char('a') && ch <= QLatin1Char('f')))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QString MediaStore::blobPath(const QString &hash) const
+{
+    return m_root.absolutePath() + QLatin1String("/blobs/") + hash.left(2) + QLatin1Char('/') + hash.mid(2, 2) + QLatin1Char('/') + hash;
+}
+
+QString MediaStore::derivativesPath(const QString &hash) const
+{
+    return m_root.absolutePath() + QLatin1String("/derivatives/") + hash.left(2) + QLatin1Char('/') + hash.mid(2, 2) + QLatin1Char('/') + hash;
+}
+
+QString MediaStore::url(const QString &hash, const QString &name)
+{
+    return QLatin1String("/.media/") + hash + QLatin1Char('/') + QFileInfo(name).fileName();
+}
+
+QString MediaStore::tempDir() const
+{
+    const QString dir = m_root.absolutePath() + QLatin1String("/tmp");
+    m_root.mkpath(dir);
+    return dir;
+}
+
+QByteArray MediaStore::hashFile(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    if (!hash.addData(&file)) {
+        return QByteArray();
+    }
+    return hash.result().toHex();
+}
+
+QString MediaStore::add(const QString &filePath, const QString &name, const QByteArray &hash)
+{
+    return addFile(filePath, name, hash, false);
+}
+
+QString MediaStore::addFile(const QString &filePath, const QString &name, const QByteArray &hash, bool move)
+{
+    m_errorString.clear();
+
+    const QString blobHash = QString::fromLatin1(hash.isEmpty() ? hashFile(filePath) : hash);
+    if (blobHash.isEmpty()) {
+        m_errorString = QStringLiteral("Could not read %1").arg(filePath);
+        return QString();
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        m_errorString = db.lastError().databaseText();
+        return QString();
+    }
+
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE media_blobs "
+                                                                  "SET refcount = refcount + 1 "
+                                                                  "WHERE hash = :hash"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":hash"), blobHash);
+    bool ok = query.exec();
+    bool newImage = false;
+    if (ok && query.numRowsAffected() == 0) {
+        static QMimeDatabase mimeDb;
+        QMimeType mime = mimeDb.mimeTypeForFile(filePath, QMimeDatabase::MatchContent);
+        if (mime.isDefault()) {
+            mime = mimeDb.mimeTypeForFile(name, QMimeDatabase::MatchExtension);
+        }
+
+        // Only reads the image header
+        QSize size;
+        if (mime.name().startsWith(QLatin1String("image/"))) {
+            size = QImageReader(filePath).size();
+        }
+
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO media_blobs "
+                                                            "(hash, size, mime, width, height, refcount, created_at) "
+                                                            "VALUES "
+                                                            "(:hash, :size, :mime, :width, :height, 1, :created_at)"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":hash"), blobHash);
+        query.bindValue(QStringLiteral(":size"), QFileInfo(filePath).size());
+        query.bindValue(QStringLiteral(":mime"), mime.name());
+        query.bindValue(QStringLiteral(":width"), size.isValid() ? QVariant(size.width()) : QVariant());
+        query.bindValue(QStringLiteral(":height"), size.isValid() ? QVariant(size.height()) : QVariant());
+        newImage = size.isValid();
+        query.bindValue(QStringLiteral(":created_at"), Engine::toSqlDateTime(QDateTime::currentDateTimeUtc()));
+        ok = query.exec();
+    }
+
+    // The write transaction is held while moving the blob in,
+    // so a concurrent remove() can't delete it under us
+    const QString blob = blobPath(blobHash);
+    bool placed = false;
+    if (ok && !QFile::exists(blob)) {
+        ok = m_root.mkpath(QFileInfo(blob).absolutePath()) &&
+                (move ? QFile::rename(filePath, blob) : copyFile(filePath, blob));
+        placed = ok;
+        if (!ok) {
+            m_errorString = QStringLiteral("Could not move %1 to %2").arg(filePath, blob);
+        }
+    }
+
+    QString storedName;
+    if (ok) {
+        storedName = uniqueName(name);
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO media "
+                                                            "(name, hash, created_at) "
+                                                            "VALUES "
+                                                            "(:name, :hash, :created_at)"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":name"), storedName);
+        query.bindValue(QStringLiteral(":hash"), blobHash);
+        query.bindValue(QStringLiteral(":created_at"), Engine::toSqlDateTime(QDateTime::currentDateTimeUtc()));
+        ok = query.exec();
+    }
+
+    if (!ok || !db.commit()) {
+        if (m_errorString.isEmpty()) {
+            m_errorString = query.lastError().databaseText();
+        }
+        qWarning() << "Failed to add media" << name << m_errorString;
+        // No row refers to it once rolled back
+        if (placed) {
+            QFile::remove(blob);
+        }
+        db.rollback();
+        return QString();
+    }
+
+    if (newImage) {
+        ImageDerivatives::instance()->enqueue(blobHash);
+    }
+
+    return storedName;
+}
+
+QString MediaStore::add(QIODevice *device, const QString &name, const QHash<QString, qint64> &maxSizes)
+{
+    m_error = NoError;
+
+    const QString tempPath = tempDir() + QLatin1Char('/') + QUuid::createUuid().toString().mid(1, 36);
+    QFile temp(tempPath);
+    if (!temp.open(QIODevice::WriteOnly)) {
+        m_error = Failed;
+        m_errorString = temp.errorString();
+        return QString();
+    }
+
+    static QMimeDatabase mimeDb;
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    qint64 maxSize = -1;
+    qint64 size = 0;
+    qint64 len;
+    while ((len = device->read(buffer.data(), buffer.size())) > 0) {
+        if (maxSize == -1) {
+            const QString type = mimeDb.mimeTypeForFileNameAndData(name, buffer.left(int(len))).name().section(QLatin1Char('/'), 0, 0);
+            maxSize = maxSizes.value(type, maxSizes.value(QStringLiteral("*"), std::numeric_limits<qint64>::max()));
+        }
+
+        size += len;
+        if (size > maxSize) {
+            m_error = TooLarge;
+            m_errorString = QStringLiteral("%1 is larger than %2 bytes").arg(name).arg(maxSize);
+            temp.remove();
+            return QString();
+        }
+
+        hash.addData(buffer.constData(), int(len));
+        if (temp.write(buffer.constData(), len) != len) {
+            m_error = Failed;
+            m_errorString = temp.errorString();
+            temp.remove();
+            return QString();
+        }
+    }
+
+    if (len < 0 || !temp.flush()) {
+        m_error = Failed;
+        m_errorString = len < 0 ? device->errorString() : temp.errorString();
+        temp.remove();
+        return QString();
+    }
+    temp.close();
+
+    // Only the temporary file is moved into the store
+    const QString ret = addFile(tempPath, name, hash.result().toHex(), true);
+    QFile::remove(tempPath);
+    if (ret.isEmpty()) {
+        m_error = Failed;
+    }
+    return ret;
+}
+
+bool MediaStore::copyFile(const QString &source, const QString &target) const
+{
+    // A hard link shares the data, other file systems get a copy
+    if (link(QFile::encodeName(source).constData(), QFile::encodeName(target).constData()) == 0) {
+        return true;
+    }
+
+    const QString temp = tempDir() + QLatin1Char('/') + QUuid::createUuid().toString().mid(1, 36);
+    if (QFile::copy(source, temp) && QFile::rename(temp, target)) {
+        return true;
+    }
+    QFile::remove(temp);
+    return false;
+}
+
+MediaStore::Error MediaStore::error() const
+{
+    return m_error;
+}
+
+bool MediaStore::remove(const QString &name)
+{
+    m_errorString.clear();
+
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        m_errorString = db.lastError().databaseText();
+        return false;
+    }
+
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT hash FROM media WHERE name = :name"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":name"), name);
+    if (!query.exec() || !query.next()) {
+        m_errorString = query.lastError().isValid() ? query.lastError().databaseText() : QStringLiteral("Media not found");
+        db.rollback();
+        return false;
+    }
+    const QString blobHash = query.value(0).toString();
+    query.finish();
+
+    bool ok;
+    query = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM media WHERE name = :name"),
+                                         QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":name"), name);
+    ok = query.exec();
+
+    if (ok) {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE media_blobs "
+                                                            "SET refcount = refcount - 1 "
+                                                            "WHERE hash = :hash"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":hash"), blobHash);
+        ok = query.exec();
+    }
+
+    if (ok) {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM media_blobs "
+                                                            "WHERE hash = :hash AND refcount <= 0"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":hash"), blobHash);
+        ok = query.exec();
+
+        // Unlinked while holding the write transaction, see add()
+        if (ok && query.numRowsAffected() > 0) {
+            removeBlob(blobHash);
+        }
+    }
+
+    if (!ok || !db.commit()) {
+        m_errorString = query.lastError().databaseText();
+        qWarning() << "Failed to remove media" << name << m_errorString;
+        db.rollback();
+        return false;
+    }
+
+    return true;
+}
+
+QString MediaStore::hash(const QString &name) const
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT hash FROM media WHERE name = :name"),
+                                                   QStringLiteral("cmlyst_ro"));
+    query.bindValue(QStringLiteral(":name"), name);
+    if (query.exec() && query.next()) {
+        return query.value(0).toString();
+    }
+    return QString();
+}
+
+QString MediaStore::name(const QString &hash) const
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT name FROM media WHERE hash = :hash "
+                                                                  "ORDER BY id LIMIT 1"),
+                                                   QStringLiteral("cmlyst_ro"));
+    query.bindValue(QStringLiteral(":hash"), hash);
+    if (query.exec() && query.next()) {
+        return query.value(0).toString();
+    }
+    return QString();
+}
+
+QVariantList MediaStore::list(const QString &search, int offset, int limit) const
+{
+    QVariantList ret;
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT m.name, m.hash, m.created_at, b.size, b.mime, b.width, b.height "
+                                                                  "FROM media m "
+                                                                  "INNER JOIN media_blobs b ON b.hash = m.hash "
+                                                                  "WHERE lower(m.name) LIKE :search ESCAPE '\\' "
+                                                                  "ORDER BY m.created_at DESC, m.id DESC "
+                                                                  "LIMIT :limit OFFSET :offset"),
+                                                   QStringLiteral("cmlyst_ro"));
+    query.bindValue(QStringLiteral(":search"), searchPattern(search));
+    query.bindValue(QStringLiteral(":limit"), limit);
+    query.bindValue(QStringLiteral(":offset"), offset);
+    if (!query.exec()) {
+        qWarning() << "Failed to list media" << query.lastError().databaseText();
+        return ret;
+    }
+
+    while (query.next()) {
+        const QString name = query.value(0).toString();
+        const QString hash = query.value(1).toString();
+        ret.append(QVariantHash{
+                       {QStringLiteral("name"), name},
+                       {QStringLiteral("hash"), hash},
+                       {QStringLiteral("url"), url(hash, name)},
+                       {QStringLiteral("created"), Engine::fromSqlDateTime(query.value(2))},
+                       {QStringLiteral("size"), query.value(3)},
+                       {QStringLiteral("mime"), query.value(4)},
+                       {QStringLiteral("width"), query.value(5)},
+                       {QStringLiteral("height"), query.value(6)},
+                   });
+    }
+    return ret;
+}
+
+int MediaStore::count(const QString &search) const
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT count(*) FROM media "
+                                                                  "WHERE lower(name) LIKE :search ESCAPE '\\'"),
+                                                   QStringLiteral("cmlyst_ro"));
+    query.bindValue(QStringLiteral(":search"), searchPattern(search));
+    if (query.exec() && query.next()) {
+        return query.value(0).toInt();
+    }
+    return 0;
+}
+
+QHash<QString, int> MediaStore::reconcile()
+{
+    QHash<QString, int> ret;
+    const QString root = m_root.absolutePath();
+    const QString blobsDir = root + QLatin1String("/blobs");
+    const QString tmpDir = root + QLatin1String("/tmp");
+    const QString derivativesDir = root + QLatin1String("/derivatives");
+
+    // Files copied into the media directory by hand, or uploaded
+    // before content addressing, are imported under their path
+    QStringList files;
+    QDirIterator it(root, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString file = it.next();
+        if (!file.startsWith(blobsDir + QLatin1Char('/')) && !file.startsWith(tmpDir + QLatin1Char('/')) &&
+                !file.startsWith(derivativesDir + QLatin1Char('/'))) {
+            files.append(file);
+        }
+    }
+
+    for (const QString &file : files) {
+        const QString name = file.mid(root.size() + 1);
+        const QString existing = hash(name);
+        if (!existing.isEmpty() && existing == QString::fromLatin1(hashFile(file))) {
+            QFile::remove(file);
+            continue;
+        }
+
+        // Kept where it was unless the import was committed
+        if (add(file, name).isEmpty()) {
+            ++ret[QStringLiteral("failed")];
+        } else {
+            QFile::remove(file);
+            ++ret[QStringLiteral("imported")];
+        }
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        m_errorString = db.lastError().databaseText();
+        return ret;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec(QStringLiteral("UPDATE media_blobs "
+                                   "SET refcount = (SELECT count(*) FROM media WHERE media.hash = media_blobs.hash)"))) {
+        m_errorString = query.lastError().databaseText();
+        db.rollback();
+        return ret;
+    }
+
+    QSet<QString> known;
+    QStringList unreferenced;
+    if (query.exec(QStringLiteral("SELECT hash, refcount FROM media_blobs"))) {
+        while (query.next()) {
+            const QString blobHash = query.value(0).toString();
+            if (query.value(1).toInt() > 0) {
+                known.insert(blobHash);
+                if (!QFile::exists(blobPath(blobHash))) {
+                    qWarning() << "Media blob is missing" << blobHash;
+                    ++ret[QStringLiteral("missing")];
+                }
+            } else {
+                unreferenced.append(blobHash);
+            }
+        }
+    }
+
+    QSqlQuery remove = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM media_blobs WHERE hash = :hash"),
+                                                    QStringLiteral("cmlyst"));
+    for (const QString &blobHash : unreferenced) {
+        remove.bindValue(QStringLiteral(":hash"), blobHash);
+        if (remove.exec()) {
+            removeBlob(blobHash);
+            ++ret[QStringLiteral("removed")];
+        }
+    }
+
+    // Blob files without a row, skipping recent ones as add()
+    // moves them in before its transaction commits
+    const QDateTime recent = QDateTime::currentDateTimeUtc().addSecs(-3600);
+    QDirIterator blobs(blobsDir, QDir::Files | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (blobs.hasNext()) {
+        const QString file = blobs.next();
+        const QFileInfo info = blobs.fileInfo();
+        if (!known.contains(info.fileName()) && info.lastModified() < recent) {
+            QFile::remove(file);
+            ++ret[QStringLiteral("removed")];
+        }
+    }
+
+    if (!db.commit()) {
+        m_errorString = db.lastError().databaseText();
+        db.rollback();
+    }
+
+    return ret;
+}
+
+QString MediaStore::errorString() const
+{
+    return m_errorString;
+}
+
+void MediaStore::removeBlob(const QString &hash) const
+{
+    QFile::remove(blobPath(hash));
+    QDir(derivativesPath(hash)).removeRecursively();
+}
+
+QString MediaStore::searchPattern(const QString &search) const
+{
+    QString pattern = search.toLower();
+    pattern.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+    pattern.replace(QLatin1Char('%'), QLatin1String("\\%"));
+    pattern.replace(QLatin1Char('_'), QLatin1String("\\_"));
+    return QLatin1Char('%') + pattern + QLatin1Char('%');
+}
+
+QString MediaStore::uniqueName(const QString &name) const
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT 1 FROM media WHERE name = :name"),
+                                                   QStringLiteral("cmlyst"));
+
+    // Same named uploads become name-1.ext, name-2.ext...
+    const QFileInfo info(name);
+    const QString dir = info.path() == QLatin1String(".") ? QString() : info.path() + QLatin1Char('/');
+    const QString suffix = info.completeSuffix().isEmpty() ? QString() : QLatin1Char('.') + info.completeSuffix();
+    QString candidate = name;
+    for (int i = 1; ; ++i) {
+        query.bindValue(QStringLiteral(":name"), candidate);
+        if (!query.exec() || !query.next()) {
+            return candidate;
+        }
+        query.finish();
+        candidate = dir + info.baseName() + QLatin1Char('-') + QString::number(i) + suffix;
+    }
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef MEDIASTORE_H
+#define MEDIASTORE_H
+
+#include <QString>
+#include <QDir>
+#include <QHash>
+#include <QVariant>
+
+class QIODevice;
+
+namespace CMS {
+
+/**
+ * Uploaded files stored by the SHA-256 of their content under
+ * blobs/ab/cd/<hash>, the media table maps the names files
+ * were uploaded with to blobs, which are shared by identical
+ * uploads and removed once nothing refers to them
+ */
+class MediaStore
+{
+public:
+    explicit MediaStore(const QString &root);
+
+    QString root() const;
+
+    static bool isHash(const QString &hash);
+    QString blobPath(const QString &hash) const;
+
+    /**
+     * Directory with the resized copies of an image blob
+     */
+    QString derivativesPath(const QString &hash) const;
+
+    /**
+     * Returns /.media/<hash>/<file name>, which never changes
+     */
+    static QString url(const QString &hash, const QString &name);
+
+    /**
+     * Where uploads should be written before being added,
+     * on the same file system so adding them is a rename
+     */
+    QString tempDir() const;
+
+    /**
+     * Copies the file at filePath into the store under name, made
+     * unique if it's taken, returns the name used or an empty string,
+     * filePath is left for the caller to remove
+     */
+    QString add(const QString &filePath, const QString &name, const QByteArray &hash = QByteArray());
+
+    /**
+     * Streams device into a temporary file next to the blobs, hashing
+     * it on the way, and adds it. maxSizes maps top level mime types,
+     * like "image", to the largest size allowed, "*" for any other,
+     * detected from the first bytes so the limit applies while copying
+     */
+    QString add(QIODevice *device, const QString &name, const QHash<QString, qint64> &maxSizes);
+
+    enum Error {
+        NoError,
+        TooLarge,
+        Failed
+    };
+    Error error() const;
+
+    bool remove(const QString &name);
+
+    /**
+     * Returns the hash of the blob name refers to, empty if unknown
+     */
+    QString hash(const QString &name) const;
+
+    /**
+     * Returns the first name uploaded for a blob, empty if unknown
+     */
+    QString name(const QString &hash) const;
+
+    /**
+     * Uploads whose name contains search, newest first
+     */
+    QVariantList list(const QString &search, int offset, int limit) const;
+    int count(const QString &search) const;
+
+    /**
+     * Imports files found outside blobs/, drops blobs nothing refers
+     * to and fixes reference counts, returns how many of each it did
+     */
+    QHash<QString, int> reconcile();
+
+    QString errorString() const;
+
+    static QByteArray hashFile(const QString &filePath);
+
+private:
+    QString addFile(const QString &filePath, const QString &name, const QByteArray &hash, bool move);
+    bool copyFile(const QString &source, const QString &target) const;
+    QString uniqueName(const QString &name) const;
+    void removeBlob(const QString &hash) const;
+    QString searchPattern(const QString &search) const;
+
+    QDir m_root;
+    QString m_errorString;
+    Error m_error = NoError;
+};
+
+}
+
+#endif // MEDIASTORE_H
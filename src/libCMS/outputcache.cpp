@@ -0,0 +1,209 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "outputcache.h"
+
+#include <QElapsedTimer>
+
+using namespace CMS;
+
+Q_GLOBAL_STATIC(OutputCache, globalOutputCache)
+
+static int entrySize(const QString &key, const OutputCache::Entry &entry)
+{
+    int size = key.size() * int(sizeof(QChar)) + entry.body.size();
+    auto it = entry.headers.constBegin();
+    while (it != entry.headers.constEnd()) {
+        size += (it.key().size() + it.value().size()) * int(sizeof(QChar));
+        ++it;
+    }
+    return size;
+}
+
+OutputCache::OutputCache()
+{
+
+}
+
+OutputCache *OutputCache::instance()
+{
+    return globalOutputCache();
+}
+
+int OutputCache::maxSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maxSize;
+}
+
+void OutputCache::setMaxSize(int bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxSize = bytes;
+    evict();
+}
+
+int OutputCache::waitTimeout() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_waitTimeout;
+}
+
+void OutputCache::setWaitTimeout(int msecs)
+{
+    QMutexLocker locker(&m_mutex);
+    m_waitTimeout = msecs;
+}
+
+bool OutputCache::serveStale() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_serveStale;
+}
+
+void OutputCache::setServeStale(bool enable)
+{
+    QMutexLocker locker(&m_mutex);
+    m_serveStale = enable;
+}
+
+OutputCache::Result OutputCache::lookup(const QString &key, Entry *entry)
+{
+    QMutexLocker locker(&m_mutex);
+
+    QElapsedTimer timer;
+    bool waited = false;
+    Q_FOREVER {
+        auto it = m_entries.constFind(key);
+        if (it != m_entries.constEnd() && !it->stale) {
+            ++m_hits;
+            *entry = it.value();
+            return Hit;
+        }
+
+        if (!m_rendering.contains(key)) {
+            ++m_misses;
+            m_rendering.insert(key);
+            return Render;
+        }
+
+        if (it != m_entries.constEnd() && m_serveStale) {
+            ++m_staleHits;
+            *entry = it.value();
+            return Stale;
+        }
+
+        if (!waited) {
+            waited = true;
+            ++m_coalesced;
+            timer.start();
+        }
+
+        const qint64 remaining = m_waitTimeout - timer.elapsed();
+        if (remaining <= 0 || !m_rendered.wait(&m_mutex, quint64(remaining))) {
+            ++m_timeouts;
+            return Bypass;
+        }
+    }
+}
+
+void OutputCache::insert(const QString &key, const Entry &entry)
+{
+    QMutexLocker locker(&m_mutex);
+
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        m_size -= entrySize(key, it.value());
+        m_entries.erase(it);
+    }
+
+    const int size = entrySize(key, entry);
+    if (size <= m_maxSize) {
+        Entry &stored = m_entries[key];
+        stored = entry;
+        // What was rendered might predate a change that came in meanwhile
+        stored.stale = m_invalidatedWhileRendering.contains(key);
+        m_size += size;
+        evict();
+    }
+
+    finish(key);
+}
+
+void OutputCache::abandon(const QString &key)
+{
+    QMutexLocker locker(&m_mutex);
+    finish(key);
+}
+
+void OutputCache::invalidate(const QStringList &keys)
+{
+    QMutexLocker locker(&m_mutex);
+    for (const QString &key : keys) {
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            it->stale = true;
+        }
+
+        if (m_rendering.contains(key)) {
+            m_invalidatedWhileRendering.insert(key);
+        }
+    }
+}
+
+QVariantHash OutputCache::stats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return {
+        {QStringLiteral("entries"), m_entries.size()},
+        {QStringLiteral("size"), m_size},
+        {QStringLiteral("hits"), m_hits},
+        {QStringLiteral("stale_hits"), m_staleHits},
+        {QStringLiteral("misses"), m_misses},
+        {QStringLiteral("coalesced_waits"), m_coalesced},
+        {QStringLiteral("wait_timeouts"), m_timeouts},
+    };
+}
+
+void OutputCache::finish(const QString &key)
+{
+    m_rendering.remove(key);
+    m_invalidatedWhileRendering.remove(key);
+    m_rendered.wakeAll();
+}
+
+void OutputCache::evict()
+{
+    // Stale entries go first, then anything until it fits
+    auto it = m_entries.begin();
+    while (m_size > m_maxSize && it != m_entries.end()) {
+        if (it->stale && !m_rendering.contains(it.key())) {
+            m_size -= entrySize(it.key(), it.value());
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    it = m_entries.begin();
+    while (m_size > m_maxSize && it != m_entries.end()) {
+        m_size -= entrySize(it.key(), it.value());
+        it = m_entries.erase(it);
+    }
+}
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef OUTPUTCACHE_H
+#define OUTPUTCACHE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QStringList>
+#include <QVariantHash>
+
+namespace CMS {
+
+/**
+ * Rendered responses shared by all worker threads of a process.
+ *
+ * Concurrent misses for the same output are coalesced, only the
+ * first one renders while the others wait for its result, or get
+ * the stale copy if serving stale entries is enabled
+ */
+class OutputCache
+{
+public:
+    struct Entry {
+        QByteArray body;
+        QHash<QString, QString> headers;
+        bool stale = false;
+    };
+
+    enum Result {
+        /** entry is fresh */
+        Hit,
+        /** entry is stale and someone else is rendering it */
+        Stale,
+        /** caller must render and then call insert() or abandon() */
+        Render,
+        /** waiting timed out, caller renders without caching */
+        Bypass
+    };
+
+    OutputCache();
+
+    /**
+     * The cache shared by the current process
+     */
+    static OutputCache *instance();
+
+    int maxSize() const;
+    void setMaxSize(int bytes);
+
+    /**
+     * Milliseconds to wait for another thread rendering
+     * the same output before rendering it as well
+     */
+    int waitTimeout() const;
+    void setWaitTimeout(int msecs);
+
+    bool serveStale() const;
+    void setServeStale(bool enable);
+
+    Result lookup(const QString &key, Entry *entry);
+
+    /**
+     * Stores what was rendered after lookup() returned Render
+     */
+    void insert(const QString &key, const Entry &entry);
+
+    /**
+     * Releases a Render that produced nothing cacheable
+     */
+    void abandon(const QString &key);
+
+    /**
+     * Marks outputs stale, they are kept for stale
+     * serving until re-rendered or evicted
+     */
+    void invalidate(const QStringList &keys);
+
+    QVariantHash stats() const;
+
+private:
+    void finish(const QString &key);
+    void evict();
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_rendered;
+    QHash<QString, Entry> m_entries;
+    QSet<QString> m_rendering;
+    QSet<QString> m_invalidatedWhileRendering;
+    int m_size = 0;
+    int m_maxSize = 32 * 1024 * 1024;
+    int m_waitTimeout = 5000;
+    bool m_serveStale = true;
+
+    quint64 m_hits = 0;
+    quint64 m_staleHits = 0;
+    quint64 m_misses = 0;
+    quint64 m_coalesced = 0;
+    quint64 m_timeouts = 0;
+};
+
+}
+
+#endif // OUTPUTCACHE_H
@@ -119,6 +119,33 @@ void Page::updateContent(const Grantlee::SafeString &body)
     d->content = body;
 }
 
+QString Page::source() const
+{
+    Q_D(const Page);
+    if (d->source.isNull()) {
+        return d->content.get();
+    }
+    return d->source;
+}
+
+void Page::setSource(const QString &source)
+{
+    Q_D(Page);
+    d->source = source;
+}
+
+QString Page::format() const
+{
+    Q_D(const Page);
+    return d->format;
+}
+
+void Page::setFormat(const QString &format)
+{
+    Q_D(Page);
+    d->format = format;
+}
+
 bool Page::published() const
 {
     Q_D(const Page);
@@ -143,6 +170,18 @@ void Page::setPublishedAt(const QDateTime &dateTime)
     d->publishedAt = dateTime;
 }
 
+bool Page::scheduled() const
+{
+    Q_D(const Page);
+    return d->scheduled;
+}
+
+void Page::setScheduled(bool enable)
+{
+    Q_D(Page);
+    d->scheduled = enable;
+}
+
 QDateTime Page::updated() const
 {
     Q_D(const Page);
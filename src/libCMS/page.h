@@ -40,10 +40,12 @@ class Page : public QObject
     Q_PROPERTY(QString path READ path WRITE setPath)
     Q_PROPERTY(Author author READ author WRITE setAuthor)
     Q_PROPERTY(Grantlee::SafeString content READ content)
+    Q_PROPERTY(QString format READ format WRITE setFormat)
     Q_PROPERTY(QDateTime published_at READ publishedAt WRITE setPublishedAt)
     Q_PROPERTY(QDateTime updated_at READ updated WRITE setUpdated)
     Q_PROPERTY(QDateTime created_at READ created WRITE setCreated)
     Q_PROPERTY(bool published READ published WRITE setPublished)
+    Q_PROPERTY(bool scheduled READ scheduled WRITE setScheduled)
     Q_PROPERTY(bool page READ page WRITE setPage)
     Q_PROPERTY(bool allowComments READ allowComments WRITE setAllowComments)
 public:
@@ -69,12 +71,28 @@ public:
     void setContent(const QString &body, bool safe);
     void updateContent(const Grantlee::SafeString &body);
 
+    /**
+     * What the author wrote, content() is what gets displayed.
+     * Both are the same HTML unless format() is "markdown"
+     */
+    QString source() const;
+    void setSource(const QString &source);
+
+    QString format() const;
+    void setFormat(const QString &format);
+
     bool published() const;
     void setPublished(bool enable);
 
     QDateTime publishedAt() const;
     void setPublishedAt(const QDateTime &dateTime);
 
+    /**
+     * Unpublished pages that get published at publishedAt()
+     */
+    bool scheduled() const;
+    void setScheduled(bool enable);
+
     QDateTime updated() const;
     void setUpdated(const QDateTime &dateTime);
 
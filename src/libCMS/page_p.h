@@ -35,12 +35,15 @@ public:
     QString path;
     Author author;
     Grantlee::SafeString content;
+    QString source;
+    QString format;
     QDateTime publishedAt;
     QDateTime updatedAt;
     QDateTime createdAt;
     int id = 0;
     bool page = false;
     bool published = false;
+    bool scheduled = false;
     bool allowComments = false;
 };
 
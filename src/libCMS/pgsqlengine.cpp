@@ -0,0 +1,194 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "pgsqlengine.h"
+
+#include <Cutelyst/Plugins/Utils/Sql>
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QAtomicInt>
+#include <QDebug>
+
+using namespace CMS;
+
+static QAtomicInt s_connections;
+
+PgSqlEngine::PgSqlEngine(QObject *parent) : SqlEngine(parent)
+{
+
+}
+
+PgSqlEngine::~PgSqlEngine()
+{
+    s_connections.fetchAndAddOrdered(-m_connections);
+}
+
+bool PgSqlEngine::init(const QHash<QString, QString> &settings)
+{
+    if (QSqlDatabase::contains(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")))) {
+        return true;
+    }
+
+    // Qt connections can only be used by the thread that created them,
+    // so the pool is one read-write and one read-only connection per
+    // thread, bounded for the whole process
+    const int maxConnections = settings.value(QStringLiteral("max_connections"), QStringLiteral("20")).toInt();
+    if (s_connections.fetchAndAddOrdered(2) + 2 > maxConnections) {
+        s_connections.fetchAndAddOrdered(-2);
+        qCritical() << "PostgreSQL connection limit reached" << maxConnections;
+        return false;
+    }
+    m_connections = 2;
+
+    fragmentCache()->setMaxSize(settings.value(QStringLiteral("fragment_cache_size"), QStringLiteral("4194304")).toInt());
+    setRevisionSnapshotInterval(settings.value(QStringLiteral("revision_snapshot_interval"), QStringLiteral("20")).toInt());
+    setContentCompressThreshold(settings.value(QStringLiteral("compress_threshold"), QStringLiteral("512")).toInt());
+
+    if (!openDatabase(QStringLiteral("cmlyst"), settings, false)) {
+        return false;
+    }
+
+    if (!setupSchema()) {
+        return false;
+    }
+
+    return openDatabase(QStringLiteral("cmlyst_ro"), settings, true);
+}
+
+bool PgSqlEngine::backup(const QString &destination, bool compress)
+{
+    Q_UNUSED(destination)
+    Q_UNUSED(compress)
+    qWarning() << "Online backup is not supported with PostgreSQL, use pg_dump";
+    return false;
+}
+
+bool PgSqlEngine::restore(const QString &source)
+{
+    Q_UNUSED(source)
+    qWarning() << "Restore is not supported with PostgreSQL, use pg_restore";
+    return false;
+}
+
+bool PgSqlEngine::lockSchema()
+{
+    // Session level, held until unlockSchema() even across the migration transactions
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    if (!query.exec(QStringLiteral("SELECT pg_advisory_lock(hashtext('cmlyst-schema'))"))) {
+        qCritical() << "Failed to lock schema" << query.lastError().databaseText();
+        return false;
+    }
+    return true;
+}
+
+void PgSqlEngine::unlockSchema()
+{
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    if (!query.exec(QStringLiteral("SELECT pg_advisory_unlock(hashtext('cmlyst-schema'))"))) {
+        qWarning() << "Failed to unlock schema" << query.lastError().databaseText();
+    }
+}
+
+QVariant PgSqlEngine::sqlLimit(int limit) const
+{
+    // LIMIT NULL is the same as no LIMIT
+    if (limit < 0) {
+        return QVariant(QVariant::Int);
+    }
+    return limit;
+}
+
+QString PgSqlEngine::autoIncrementKey() const
+{
+    return QStringLiteral("SERIAL PRIMARY KEY");
+}
+
+QString PgSqlEngine::dateTimeType() const
+{
+    return QStringLiteral("TIMESTAMP");
+}
+
+QString PgSqlEngine::blobType() const
+{
+    return QStringLiteral("BYTEA");
+}
+
+int PgSqlEngine::schemaVersion()
+{
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    if (!query.exec(QStringLiteral("CREATE TABLE IF NOT EXISTS schema_version (version INTEGER NOT NULL)"))) {
+        qCritical() << "Failed to create schema version table" << query.lastError().databaseText();
+        return -1;
+    }
+
+    if (!query.exec(QStringLiteral("SELECT version FROM schema_version"))) {
+        qCritical() << "Failed to get schema version" << query.lastError().databaseText();
+        return -1;
+    }
+
+    if (query.next()) {
+        return query.value(0).toInt();
+    }
+    return 1;
+}
+
+bool PgSqlEngine::setSchemaVersion(int version)
+{
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    if (!query.exec(QStringLiteral("CREATE TABLE IF NOT EXISTS schema_version (version INTEGER NOT NULL)")) ||
+            !query.exec(QStringLiteral("DELETE FROM schema_version")) ||
+            !query.exec(QLatin1String("INSERT INTO schema_version (version) VALUES (") + QString::number(version) + QLatin1Char(')'))) {
+        qCritical() << "Failed to set schema version" << query.lastError().databaseText();
+        return false;
+    }
+    return true;
+}
+
+bool PgSqlEngine::openDatabase(const QString &name, const QHash<QString, QString> &settings, bool readOnly)
+{
+    QString host = settings.value(QStringLiteral("host"));
+    if (readOnly && settings.contains(QStringLiteral("ro_host"))) {
+        host = settings.value(QStringLiteral("ro_host"));
+    }
+
+    auto db = QSqlDatabase::addDatabase(QStringLiteral("QPSQL"), Cutelyst::Sql::databaseNameThread(name));
+    db.setHostName(host);
+    db.setPort(settings.value(QStringLiteral("port"), QStringLiteral("5432")).toInt());
+    db.setDatabaseName(settings.value(QStringLiteral("database"), QStringLiteral("cmlyst")));
+    db.setUserName(settings.value(QStringLiteral("user")));
+    db.setPassword(settings.value(QStringLiteral("password")));
+    db.setConnectOptions(QLatin1String("application_name=cmlyst;connect_timeout=") +
+                         settings.value(QStringLiteral("connect_timeout"), QStringLiteral("10")));
+    if (!db.open()) {
+        qCritical() << "Error opening database" << name << host << db.lastError().databaseText();
+        return false;
+    }
+    qDebug() << "Database is open:" << host << db.databaseName() << db.connectionName();
+
+    QSqlQuery query(db);
+    if (!query.exec(QStringLiteral("SET TIME ZONE 'UTC'")) ||
+            (readOnly && !query.exec(QStringLiteral("SET SESSION CHARACTERISTICS AS TRANSACTION READ ONLY")))) {
+        qCritical() << "Error configuring database" << name << query.lastError().databaseText();
+        return false;
+    }
+
+    return true;
+}
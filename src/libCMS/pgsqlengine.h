@@ -0,0 +1,65 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef PGSQLENGINE_H
+#define PGSQLENGINE_H
+
+#include "sqlengine.h"
+
+namespace CMS {
+
+/**
+ * Stores everything on a PostgreSQL server, each thread
+ * opens a read-write and a read-only connection, the number
+ * of connections a process can open is bounded by max_connections
+ */
+class PgSqlEngine : public SqlEngine
+{
+    Q_OBJECT
+public:
+    explicit PgSqlEngine(QObject *parent = 0);
+    ~PgSqlEngine();
+
+    virtual bool init(const QHash<QString, QString> &settings) override;
+
+    virtual bool backup(const QString &destination, bool compress) override;
+    virtual bool restore(const QString &source) override;
+
+protected:
+    virtual QVariant sqlLimit(int limit) const override;
+
+    virtual QString autoIncrementKey() const override;
+    virtual QString dateTimeType() const override;
+    virtual QString blobType() const override;
+
+    virtual int schemaVersion() override;
+    virtual bool setSchemaVersion(int version) override;
+
+    virtual bool lockSchema() override;
+    virtual void unlockSchema() override;
+
+private:
+    bool openDatabase(const QString &name, const QHash<QString, QString> &settings, bool readOnly);
+
+    int m_connections = 0;
+};
+
+}
+
+#endif // PGSQLENGINE_H
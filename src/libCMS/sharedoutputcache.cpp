@@ -0,0 +1,390 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sharedoutputcache.h"
+
+#include <QFile>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SHARED_CACHE_MAGIC 0x434d4f43
+#define SHARED_CACHE_VERSION 1
+#define SHARED_CACHE_TOMBS 4096
+#define SHARED_CACHE_PROBES 4
+#define SHARED_CACHE_READ_RETRIES 3
+
+namespace CMS {
+
+struct SharedCacheHeader {
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 slotSize;
+    std::atomic<qint64> generation;
+    std::atomic<quint64> hits;
+    std::atomic<quint64> misses;
+    std::atomic<quint64> stores;
+    // Newest generation that invalidated a key hashing into each
+    std::atomic<qint64> tombs[SHARED_CACHE_TOMBS];
+};
+
+struct SharedCacheSlot {
+    std::atomic<quint32> sequence;
+    quint32 size;
+    quint64 hash;
+    qint64 generation;
+    qint64 storedAt;
+    char data[1];
+};
+
+}
+
+using namespace CMS;
+
+Q_GLOBAL_STATIC(SharedOutputCache, globalSharedOutputCache)
+
+static quint64 keyHash(const QString &key)
+{
+    // FNV-1a, qHash() is seeded per process
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    const QByteArray data = key.toUtf8();
+    for (char ch : data) {
+        hash ^= uchar(ch);
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+SharedOutputCache::SharedOutputCache()
+{
+
+}
+
+SharedOutputCache::~SharedOutputCache()
+{
+    if (m_map) {
+        munmap(m_map, size_t(m_mapSize));
+    }
+
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+SharedOutputCache *SharedOutputCache::instance()
+{
+    return globalSharedOutputCache();
+}
+
+bool SharedOutputCache::open(const QString &path, int slotCount, int slotSize)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_map) {
+        return true;
+    }
+
+    slotSize = qMax(slotSize, int(sizeof(SharedCacheSlot)) + 1024);
+    slotSize = (slotSize + 7) & ~7;
+    const qint64 size = qint64(sizeof(SharedCacheHeader)) + qint64(slotCount) * slotSize;
+
+    const QByteArray fileName = QFile::encodeName(path);
+
+    // Serializes creating the file, a live one is never resized or
+    // cleared but replaced, processes mapping it keep the old copy
+    const int lockFd = ::open(QByteArray(fileName + ".lock").constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lockFd == -1 || flock(lockFd, LOCK_EX) == -1) {
+        qWarning() << "Failed to lock shared output cache" << path << qt_error_string(errno);
+        if (lockFd != -1) {
+            close(lockFd);
+        }
+        return false;
+    }
+
+    const int fd = ::open(fileName.constData(), O_RDWR | O_CLOEXEC);
+    if (fd != -1 && !map(fd, size)) {
+        close(fd);
+    }
+
+    // One from a different layout is replaced by an empty one
+    if (m_map && (m_header->magic != SHARED_CACHE_MAGIC || m_header->version != SHARED_CACHE_VERSION ||
+                  m_header->slotCount != quint32(slotCount) || m_header->slotSize != quint32(slotSize))) {
+        unmap();
+    }
+
+    if (!m_map && !create(fileName, size, slotCount, slotSize)) {
+        qWarning() << "Failed to create shared output cache" << path << qt_error_string(errno);
+        close(lockFd);
+        return false;
+    }
+
+    // Closing it releases the lock
+    close(lockFd);
+
+    qDebug() << "Shared output cache" << path << slotCount << "slots of" << slotSize << "bytes";
+    return true;
+}
+
+bool SharedOutputCache::map(int fd, qint64 size)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size != size) {
+        return false;
+    }
+
+    void *map = mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    m_fd = fd;
+    m_map = static_cast<uchar *>(map);
+    m_mapSize = size;
+    m_header = reinterpret_cast<SharedCacheHeader *>(m_map);
+    return true;
+}
+
+void SharedOutputCache::unmap()
+{
+    munmap(m_map, size_t(m_mapSize));
+    close(m_fd);
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_header = nullptr;
+    m_fd = -1;
+}
+
+bool SharedOutputCache::create(const QByteArray &fileName, qint64 size, int slotCount, int slotSize)
+{
+    // Zero filled, and only visible under fileName once initialized
+    QByteArray temp = fileName + ".XXXXXX";
+    const int fd = mkostemp(temp.data(), O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    if (ftruncate(fd, size) == -1 || !map(fd, size)) {
+        unlink(temp.constData());
+        close(fd);
+        return false;
+    }
+
+    m_header->slotCount = quint32(slotCount);
+    m_header->slotSize = quint32(slotSize);
+    m_header->version = SHARED_CACHE_VERSION;
+    m_header->magic = SHARED_CACHE_MAGIC;
+
+    if (rename(temp.constData(), fileName.constData()) == -1) {
+        unlink(temp.constData());
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool SharedOutputCache::isOpen() const
+{
+    return m_map;
+}
+
+bool SharedOutputCache::value(const QString &key, OutputCache::Entry *entry)
+{
+    if (!m_map) {
+        return false;
+    }
+
+    const quint64 hash = keyHash(key);
+    const qint64 tomb = m_header->tombs[hash % SHARED_CACHE_TOMBS].load(std::memory_order_acquire);
+    const quint32 capacity = m_header->slotSize - quint32(offsetof(SharedCacheSlot, data));
+
+    for (int probe = 0; probe < SHARED_CACHE_PROBES; ++probe) {
+        SharedCacheSlot *slot = slotAt(hash, probe);
+        for (int retry = 0; retry < SHARED_CACHE_READ_RETRIES; ++retry) {
+            const quint32 sequence = slot->sequence.load(std::memory_order_acquire);
+            if (sequence & 1) {
+                // Being written
+                continue;
+            }
+
+            if (slot->hash != hash || slot->size == 0 || slot->size > capacity) {
+                break;
+            }
+
+            const qint64 generation = slot->generation;
+            const QByteArray data(slot->data, int(slot->size));
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->sequence.load(std::memory_order_relaxed) != sequence) {
+                continue;
+            }
+
+            if (generation < tomb) {
+                break;
+            }
+
+            QString storedKey;
+            OutputCache::Entry stored;
+            QDataStream stream(data);
+            stream >> storedKey >> stored.headers >> stored.body;
+            if (stream.status() != QDataStream::Ok || storedKey != key) {
+                break;
+            }
+
+            m_header->hits.fetch_add(1, std::memory_order_relaxed);
+            *entry = stored;
+            return true;
+        }
+    }
+
+    m_header->misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool SharedOutputCache::insert(const QString &key, qint64 generation, const OutputCache::Entry &entry)
+{
+    if (!m_map) {
+        return false;
+    }
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << key << entry.headers << entry.body;
+
+    const quint32 capacity = m_header->slotSize - quint32(offsetof(SharedCacheSlot, data));
+    if (quint32(data.size()) > capacity) {
+        return false;
+    }
+
+    const quint64 hash = keyHash(key);
+    QMutexLocker locker(&m_mutex);
+    if (!lock()) {
+        return false;
+    }
+
+    // Rendered before a change that might not have seen it yet
+    if (generation < m_header->generation.load(std::memory_order_acquire) ||
+            generation < m_header->tombs[hash % SHARED_CACHE_TOMBS].load(std::memory_order_acquire)) {
+        unlock();
+        return false;
+    }
+
+    // Same key, else an empty slot, else the oldest one
+    SharedCacheSlot *target = nullptr;
+    for (int probe = 0; probe < SHARED_CACHE_PROBES; ++probe) {
+        SharedCacheSlot *slot = slotAt(hash, probe);
+        if (slot->hash == hash && slot->size) {
+            target = slot;
+            break;
+        }
+
+        if (!target || (target->size && (!slot->size || slot->storedAt < target->storedAt))) {
+            target = slot;
+        }
+    }
+
+    const quint32 sequence = target->sequence.load(std::memory_order_relaxed);
+    target->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    target->hash = hash;
+    target->generation = generation;
+    target->storedAt = QDateTime::currentMSecsSinceEpoch();
+    target->size = quint32(data.size());
+    memcpy(target->data, data.constData(), size_t(data.size()));
+
+    target->sequence.store(sequence + 2, std::memory_order_release);
+    m_header->stores.fetch_add(1, std::memory_order_relaxed);
+
+    unlock();
+    return true;
+}
+
+void SharedOutputCache::startGeneration(qint64 generation)
+{
+    if (!m_map) {
+        return;
+    }
+
+    qint64 current = m_header->generation.load(std::memory_order_relaxed);
+    while (current < generation &&
+           !m_header->generation.compare_exchange_weak(current, generation, std::memory_order_acq_rel)) {
+    }
+}
+
+void SharedOutputCache::invalidate(const QStringList &keys, qint64 generation)
+{
+    if (!m_map) {
+        return;
+    }
+
+    for (const QString &key : keys) {
+        std::atomic<qint64> &tomb = m_header->tombs[keyHash(key) % SHARED_CACHE_TOMBS];
+        qint64 current = tomb.load(std::memory_order_relaxed);
+        while (current < generation &&
+               !tomb.compare_exchange_weak(current, generation, std::memory_order_acq_rel)) {
+        }
+    }
+}
+
+QVariantHash SharedOutputCache::stats() const
+{
+    if (!m_map) {
+        return QVariantHash();
+    }
+
+    return {
+        {QStringLiteral("slots"), m_header->slotCount},
+        {QStringLiteral("slot_size"), m_header->slotSize},
+        {QStringLiteral("hits"), m_header->hits.load(std::memory_order_relaxed)},
+        {QStringLiteral("misses"), m_header->misses.load(std::memory_order_relaxed)},
+        {QStringLiteral("stores"), m_header->stores.load(std::memory_order_relaxed)},
+    };
+}
+
+SharedCacheSlot *SharedOutputCache::slotAt(quint64 hash, int probe) const
+{
+    const quint64 index = (hash + quint64(probe)) % m_header->slotCount;
+    return reinterpret_cast<SharedCacheSlot *>(m_map + sizeof(SharedCacheHeader) + index * m_header->slotSize);
+}
+
+bool SharedOutputCache::lock()
+{
+    if (flock(m_fd, LOCK_EX) == -1) {
+        qWarning() << "Failed to lock shared output cache" << qt_error_string(errno);
+        return false;
+    }
+    return true;
+}
+
+void SharedOutputCache::unlock()
+{
+    flock(m_fd, LOCK_UN);
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SHAREDOUTPUTCACHE_H
+#define SHAREDOUTPUTCACHE_H
+
+#include <QMutex>
+#include <QStringList>
+#include <QVariantHash>
+
+#include "outputcache.h"
+
+namespace CMS {
+
+struct SharedCacheHeader;
+struct SharedCacheSlot;
+
+/**
+ * Rendered outputs stored on a memory mapped file that all
+ * worker processes of a host map, so each output is rendered
+ * and kept once instead of once per worker.
+ *
+ * The file is a header followed by fixed size slots found by
+ * hashing the key. Readers don't lock, they retry if a slot's
+ * sequence number changed while copying it, writers serialize
+ * with flock(). Every entry keeps the generation it was rendered
+ * on and is ignored once an invalidation for a newer one is seen.
+ */
+class SharedOutputCache
+{
+public:
+    SharedOutputCache();
+    ~SharedOutputCache();
+
+    /**
+     * The cache shared by the current process, it must be
+     * opened after forking as flock() locks are per open file
+     */
+    static SharedOutputCache *instance();
+
+    bool open(const QString &path, int slotCount, int slotSize);
+    bool isOpen() const;
+
+    bool value(const QString &key, OutputCache::Entry *entry);
+
+    /**
+     * Stores entry rendered on generation unless something
+     * changed since, returns false if it wasn't stored
+     */
+    bool insert(const QString &key, qint64 generation, const OutputCache::Entry &entry);
+
+    /**
+     * A change started generation, entries rendered before
+     * it can not be stored anymore
+     */
+    void startGeneration(qint64 generation);
+
+    /**
+     * Entries for keys rendered before generation become invalid
+     */
+    void invalidate(const QStringList &keys, qint64 generation);
+
+    QVariantHash stats() const;
+
+private:
+    SharedCacheSlot *slotAt(quint64 hash, int probe) const;
+    bool map(int fd, qint64 size);
+    void unmap();
+    bool create(const QByteArray &fileName, qint64 size, int slotCount, int slotSize);
+    bool lock();
+    void unlock();
+
+    QMutex m_mutex;
+    SharedCacheHeader *m_header = nullptr;
+    uchar *m_map = nullptr;
+    qint64 m_mapSize = 0;
+    int m_fd = -1;
+};
+
+}
+
+#endif // SHAREDOUTPUTCACHE_H
@@ -0,0 +1,105 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sitecontext_p.h"
+
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+
+#include <grantlee/safestring.h>
+
+using namespace CMS;
+
+SiteContext::SiteContext(const QHash<QString, QString> &settings, QObject *parent) : QObject(parent)
+  , d_ptr(new SiteContextPrivate)
+{
+    Q_D(SiteContext);
+    d->title = settings.value(QStringLiteral("title"));
+    d->tagline = settings.value(QStringLiteral("tagline"));
+    d->theme = settings.value(QStringLiteral("theme"), QStringLiteral("default"));
+    d->themePath = QLatin1String("/static/themes/") + d->theme;
+    d->postsPerPage = settings.value(QStringLiteral("posts_per_page"), QStringLiteral("10")).toInt();
+
+    d->stash.insert(QStringLiteral("meta_title"), d->title);
+    d->stash.insert(QStringLiteral("meta_description"), d->tagline);
+
+    const QString cms_head = settings.value(QStringLiteral("cms_head"));
+    if (!cms_head.isEmpty()) {
+        d->stash.insert(QStringLiteral("cms_head"), QVariant::fromValue(Grantlee::SafeString(cms_head, true)));
+    }
+
+    const QString cms_foot = settings.value(QStringLiteral("cms_foot"));
+    if (!cms_foot.isEmpty()) {
+        d->stash.insert(QStringLiteral("cms_foot"), QVariant::fromValue(Grantlee::SafeString(cms_foot, true)));
+    }
+}
+
+SiteContext::~SiteContext()
+{
+    delete d_ptr;
+}
+
+QString SiteContext::title() const
+{
+    Q_D(const SiteContext);
+    return d->title;
+}
+
+QString SiteContext::tagline() const
+{
+    Q_D(const SiteContext);
+    return d->tagline;
+}
+
+QString SiteContext::theme() const
+{
+    Q_D(const SiteContext);
+    return d->theme;
+}
+
+int SiteContext::postsPerPage() const
+{
+    Q_D(const SiteContext);
+    return d->postsPerPage;
+}
+
+const QVariantHash &SiteContext::stash() const
+{
+    Q_D(const SiteContext);
+    return d->stash;
+}
+
+QString SiteContext::baseTheme(Cutelyst::Context *c) const
+{
+    Q_D(const SiteContext);
+    const QString base = c->req()->base();
+    auto it = d->baseThemes.constFind(base);
+    if (it != d->baseThemes.constEnd()) {
+        return it.value();
+    }
+
+    // The base comes from the Host header, don't let it grow unbounded
+    if (d->baseThemes.size() > 16) {
+        d->baseThemes.clear();
+    }
+
+    const QString url = c->uriFor(d->themePath).toString();
+    d->baseThemes.insert(base, url);
+    return url;
+}
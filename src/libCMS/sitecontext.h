@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SITECONTEXT_H
+#define SITECONTEXT_H
+
+#include <QObject>
+#include <QVariant>
+#include <QHash>
+
+namespace Cutelyst {
+class Context;
+}
+
+namespace CMS {
+
+class SiteContextPrivate;
+/**
+ * Values derived from the settings that every front end
+ * request needs, built once per settings generation
+ */
+class SiteContext : public QObject
+{
+    Q_OBJECT
+    Q_DECLARE_PRIVATE(SiteContext)
+public:
+    explicit SiteContext(const QHash<QString, QString> &settings, QObject *parent = 0);
+    ~SiteContext();
+
+    QString title() const;
+    QString tagline() const;
+    QString theme() const;
+    int postsPerPage() const;
+
+    /**
+     * cms_head, cms_foot, meta_title and meta_description
+     * ready to be merged into the stash
+     */
+    const QVariantHash &stash() const;
+
+    /**
+     * URL of the theme static files, it's only built
+     * once for each request base
+     */
+    QString baseTheme(Cutelyst::Context *c) const;
+
+protected:
+    SiteContextPrivate *d_ptr;
+};
+
+}
+
+Q_DECLARE_METATYPE(CMS::SiteContext *)
+
+#endif // SITECONTEXT_H
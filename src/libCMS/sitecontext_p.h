@@ -0,0 +1,41 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SITECONTEXT_P_H
+#define SITECONTEXT_P_H
+
+#include "sitecontext.h"
+
+namespace CMS {
+
+class SiteContextPrivate
+{
+public:
+    QString title;
+    QString tagline;
+    QString theme;
+    QString themePath;
+    int postsPerPage = 10;
+    QVariantHash stash;
+    mutable QHash<QString, QString> baseThemes;
+};
+
+}
+
+#endif // SITECONTEXT_P_H
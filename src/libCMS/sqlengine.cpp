@@ -1,18 +1,25 @@
 #include "sqlengine.h"
 #include "page.h"
 #include "menu.h"
+#include "sitecontext.h"
+#include "sqlitebackup.h"
+#include "jobscheduler.h"
+#include "textdelta.h"
+#include "contentcodec.h"
+#include "markdown.h"
 
-#include <Cutelyst/Plugins/View/Grantlee/grantleeview.h>
 #include <Cutelyst/Plugins/Utils/Sql>
 #include <Cutelyst/Context>
 #include <Cutelyst/Application>
 
 #include <QDir>
+#include <QTimer>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
 
 #include <QRegularExpression>
+#include <QVector>
 
 #include <QJsonArray>
 #include <QJsonObject>
@@ -20,6 +27,12 @@
 
 #include <QLoggingCategory>
 
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
 Q_LOGGING_CATEGORY(CMS_SQLENGINE, "cms.sqlengine")
 
 using namespace CMS;
@@ -37,28 +50,171 @@ bool SqlEngine::init(const QHash<QString, QString> &settings)
     }
 
     const QString dbPath = root + QLatin1String("/cmlyst.sqlite");
-    bool create = !QFile::exists(dbPath);
+    m_dbPath = dbPath;
+    m_schemaLockPath = root + QLatin1String("/schema.lock");
 
     if (QSqlDatabase::contains(QStringLiteral("cmlyst"))) {
         return true;
     }
 
+    setContentCompressThreshold(settings.value(QStringLiteral("compress_threshold"), QStringLiteral("512")).toInt());
+
     auto db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
     db.setDatabaseName(dbPath);
     if (db.open()) {
         qDebug() << "Database is open:" << dbPath << db.connectionName();
-        if (create) {
-            createDb();
-            qDebug() << "Database tables created";
+        if (!applyPragmas(db, settings, false)) {
+            return false;
+        }
+
+        if (!setupSchema()) {
+            return false;
         }
     } else {
         qCritical() << "Error opening database" << dbPath << db.lastError().databaseText();
         return false;
     }
 
+    // Front end requests only read, so they get their own read only
+    // connection that never takes the write lock and can map the
+    // whole database in memory, the one above is used for mutations
+    auto roDb = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst_ro")));
+    roDb.setDatabaseName(dbPath);
+    roDb.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY"));
+    if (roDb.open()) {
+        if (!applyPragmas(roDb, settings, true)) {
+            return false;
+        }
+    } else {
+        qCritical() << "Error opening read only database" << dbPath << roDb.lastError().databaseText();
+        return false;
+    }
+
+    m_fragmentCache.setMaxSize(settings.value(QStringLiteral("fragment_cache_size"), QStringLiteral("4194304")).toInt());
+    setRevisionSnapshotInterval(settings.value(QStringLiteral("revision_snapshot_interval"), QStringLiteral("20")).toInt());
+
+    // Checkpoint the WAL regularly as long running readers
+    // can prevent the automatic checkpoint from resetting it
+    const int checkpointInterval = settings.value(QStringLiteral("checkpoint_interval"), QStringLiteral("60")).toInt();
+    if (checkpointInterval > 0) {
+        m_checkpointIdle = settings.value(QStringLiteral("checkpoint_idle"), QStringLiteral("300")).toLongLong() * 1000;
+        m_busyTimeout = settings.value(QStringLiteral("busy_timeout"), QStringLiteral("5000")).toInt();
+        m_checkpointLockPath = root + QLatin1String("/checkpoint.lock");
+        m_lastWrite.start();
+
+        m_checkpointTimer = new QTimer(this);
+        m_checkpointTimer->setInterval(checkpointInterval * 1000);
+        connect(m_checkpointTimer, &QTimer::timeout, this, &SqlEngine::checkpoint);
+        m_checkpointTimer->start();
+    }
+
+    return true;
+}
+
+bool SqlEngine::applyPragmas(QSqlDatabase &db, const QHash<QString, QString> &settings, bool readOnly)
+{
+    const QString synchronous = settings.value(QStringLiteral("synchronous"), QStringLiteral("NORMAL")).toUpper();
+    const QString tempStore = settings.value(QStringLiteral("temp_store"), QStringLiteral("MEMORY")).toUpper();
+    static const QStringList synchronousValues = {
+        QStringLiteral("OFF"), QStringLiteral("NORMAL"), QStringLiteral("FULL"), QStringLiteral("EXTRA")
+    };
+    static const QStringList tempStoreValues = {
+        QStringLiteral("DEFAULT"), QStringLiteral("FILE"), QStringLiteral("MEMORY")
+    };
+    if (!synchronousValues.contains(synchronous) || !tempStoreValues.contains(tempStore)) {
+        qCritical() << "Invalid SQLite synchronous or temp_store value" << synchronous << tempStore;
+        return false;
+    }
+
+    // PRAGMA values can't be bound so only numbers and the values above get here
+    QStringList pragmas = {
+        QLatin1String("PRAGMA temp_store = ") + tempStore,
+        QLatin1String("PRAGMA cache_size = ") +
+        QString::number(settings.value(QStringLiteral("cache_size"), QStringLiteral("-16000")).toLongLong()),
+        QLatin1String("PRAGMA busy_timeout = ") +
+        QString::number(settings.value(QStringLiteral("busy_timeout"), QStringLiteral("5000")).toInt()),
+    };
+
+    if (readOnly) {
+        pragmas.append(QStringLiteral("PRAGMA query_only = 1"));
+        pragmas.append(QLatin1String("PRAGMA mmap_size = ") +
+                       QString::number(settings.value(QStringLiteral("ro_mmap_size"), QStringLiteral("1073741824")).toLongLong()));
+    } else {
+        pragmas.append(QStringLiteral("PRAGMA journal_mode = WAL"));
+        pragmas.append(QLatin1String("PRAGMA synchronous = ") + synchronous);
+        pragmas.append(QLatin1String("PRAGMA mmap_size = ") +
+                       QString::number(settings.value(QStringLiteral("mmap_size"), QStringLiteral("268435456")).toLongLong()));
+    }
+
+    QSqlQuery query(db);
+    for (const QString &pragma : pragmas) {
+        if (!query.exec(pragma)) {
+            qWarning() << "Failed to set" << pragma << query.lastError().databaseText();
+        }
+    }
     return true;
 }
 
+bool SqlEngine::holdsCheckpointLock()
+{
+    if (m_checkpointLockFd == -1) {
+        m_checkpointLockFd = ::open(QFile::encodeName(m_checkpointLockPath).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (m_checkpointLockFd == -1) {
+            qCWarning(CMS_SQLENGINE) << "Failed to open checkpoint lock" << m_checkpointLockPath << strerror(errno);
+            m_checkpointTimer->stop();
+            return false;
+        }
+    }
+
+    // Kept until we exit, locks are per open file so
+    // only one thread of one process gets it
+    if (!m_checkpointLeader) {
+        m_checkpointLeader = flock(m_checkpointLockFd, LOCK_EX | LOCK_NB) == 0;
+    }
+    return m_checkpointLeader;
+}
+
+void SqlEngine::checkpoint()
+{
+    // A single worker checkpoints for the whole host
+    if (!holdsCheckpointLock()) {
+        return;
+    }
+
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+
+    // Changes when other connections, of any process, commit
+    if (query.exec(QStringLiteral("PRAGMA data_version")) && query.next()) {
+        const qint64 dataVersion = query.value(0).toLongLong();
+        if (dataVersion != m_dataVersion) {
+            m_dataVersion = dataVersion;
+            m_lastWrite.restart();
+            m_truncated = false;
+        }
+    }
+    query.finish();
+
+    // When nothing was written for a while truncate the WAL file
+    // so it doesn't stay at its largest size, otherwise just copy
+    // what we can back to the database without blocking
+    if (m_lastWrite.elapsed() >= m_checkpointIdle) {
+        if (!m_truncated) {
+            // Give up right away if a reader is still on the WAL,
+            // waiting would hold the write lock and stall writers
+            query.exec(QStringLiteral("PRAGMA busy_timeout = 0"));
+            if (query.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)")) && query.next()) {
+                m_truncated = query.value(0).toInt() == 0;
+            } else {
+                qCWarning(CMS_SQLENGINE) << "Failed to truncate WAL" << query.lastError().databaseText();
+            }
+            query.finish();
+            query.exec(QLatin1String("PRAGMA busy_timeout = ") + QString::number(m_busyTimeout));
+        }
+    } else if (!query.exec(QStringLiteral("PRAGMA wal_checkpoint(PASSIVE)"))) {
+        qCWarning(CMS_SQLENGINE) << "Failed to checkpoint WAL" << query.lastError().databaseText();
+    }
+}
+
 Page *SqlEngine::createPageObj(const QSqlQuery &query, QObject *parent)
 {
     auto page = new Page(parent);
@@ -68,22 +224,31 @@ Page *SqlEngine::createPageObj(const QSqlQuery &query, QObject *parent)
     Author author = m_usersId.value(author_id);
     page->setAuthor(author);
     page->setPage(query.value(QStringLiteral("page")).toBool());
-    page->setContent(query.value(QStringLiteral("content")).toString(), true);
+    // Front end queries only get the source when nothing was rendered
+    const QString format = query.value(QStringLiteral("format")).toString();
+    const QVariant html = query.value(QStringLiteral("html"));
+    const QString source = ContentCodec::content(query.value(QStringLiteral("content")), query.value(QStringLiteral("content_z")));
+    page->setFormat(format);
+    if (format == QLatin1String("markdown")) {
+        if (!source.isNull()) {
+            page->setSource(source);
+        }
+        page->setContent(html.isNull() ? Markdown::toHtml(source) : html.toString(), true);
+    } else {
+        page->setContent(source, true);
+    }
 
-    QDateTime updated = QDateTime::fromString(query.value(QStringLiteral("updated_at")).toString(), QStringLiteral("yyyy-MM-dd HH:mm:ss"));
-    updated.setTimeSpec(Qt::UTC);
+    QDateTime updated = fromSqlDateTime(query.value(QStringLiteral("updated_at")));
     updated = updated.toTimeZone(m_timezone);
     updated.setTimeSpec(Qt::LocalTime);
     page->setUpdated(updated);
 
-    QDateTime created = QDateTime::fromString(query.value(QStringLiteral("created_at")).toString(), QStringLiteral("yyyy-MM-dd HH:mm:ss"));
-    created.setTimeSpec(Qt::UTC);
+    QDateTime created = fromSqlDateTime(query.value(QStringLiteral("created_at")));
     created = created.toTimeZone(m_timezone);
     created.setTimeSpec(Qt::LocalTime);
     page->setCreated(created);
 
-    QDateTime published = QDateTime::fromString(query.value(QStringLiteral("published_at")).toString(), QStringLiteral("yyyy-MM-dd HH:mm:ss"));
-    published.setTimeSpec(Qt::UTC);
+    QDateTime published = fromSqlDateTime(query.value(QStringLiteral("published_at")));
     published = published.toTimeZone(m_timezone);
     published.setTimeSpec(Qt::LocalTime);
     page->setPublishedAt(published);
@@ -93,17 +258,19 @@ Page *SqlEngine::createPageObj(const QSqlQuery &query, QObject *parent)
     page->setUuid(query.value(QStringLiteral("uuid")).toString());
     page->setId(query.value(QStringLiteral("id")).toInt());
     page->setPublished(query.value(QStringLiteral("published")).toBool());
+    page->setScheduled(query.value(QStringLiteral("status")).toString() == QLatin1String("scheduled"));
 
     return page;
 }
 
 Page *SqlEngine::getPage(const QString &path, QObject *parent)
 {
-    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                                                                  " created_at, updated_at, published_at, page, allow_comments, published "
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, uuid, path, title, author_id, html, format,"
+                                                                  " CASE WHEN html IS NULL THEN content END AS content, CASE WHEN html IS NULL THEN content_z END AS content_z,"
+                                                                  " created_at, updated_at, published_at, page, allow_comments, published, status "
                                                                   "FROM posts "
                                                                   "WHERE path = :path"),
-                                                   QStringLiteral("cmlyst"));
+                                                   QStringLiteral("cmlyst_ro"));
     if (!path.isNull()) {
         query.bindValue(QStringLiteral(":path"), path);
     } else {
@@ -112,7 +279,10 @@ Page *SqlEngine::getPage(const QString &path, QObject *parent)
 
     if (Q_LIKELY(query.exec())) {
         if (query.next()) {
-            return createPageObj(query, parent);
+            Page *page = createPageObj(query, parent);
+            // Don't keep the read transaction open until the next request
+            query.finish();
+            return page;
         }
     } else {
         qWarning() << "Failed to get page" << path << query.lastError().databaseText();
@@ -122,8 +292,8 @@ Page *SqlEngine::getPage(const QString &path, QObject *parent)
 
 Page *SqlEngine::getPageById(const QString &id, QObject *parent)
 {
-    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                                                                  " created_at, updated_at, published_at, page, allow_comments, published "
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, uuid, path, title, author_id, content, content_z, html, format,"
+                                                                  " created_at, updated_at, published_at, page, allow_comments, published, status "
                                                                   "FROM posts "
                                                                   "WHERE id = :id"),
                                                    QStringLiteral("cmlyst"));
@@ -142,11 +312,28 @@ Page *SqlEngine::getPageById(const QString &id, QObject *parent)
 
 bool SqlEngine::removePage(int id)
 {
-    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM posts "
+    QStringList entities = { QLatin1String("post:") + QString::number(id) };
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT page, author_id FROM posts "
                                                                   "WHERE id = :id"),
                                                    QStringLiteral("cmlyst"));
     query.bindValue(QStringLiteral(":id"), id);
+    if (query.exec() && query.next()) {
+        entities.append(postEntities(query.value(0).toBool(), query.value(1).toInt()));
+    }
+
+    query = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM posts "
+                                                        "WHERE id = :id"),
+                                         QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":id"), id);
     if (query.exec() && query.numRowsAffected() == 1) {
+        QSqlQuery revisions = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM revisions "
+                                                                          "WHERE post_id = :post_id"),
+                                                           QStringLiteral("cmlyst"));
+        revisions.bindValue(QStringLiteral(":post_id"), id);
+        if (!revisions.exec()) {
+            qWarning() << "Failed to remove revisions of page" << id << revisions.lastError().databaseText();
+        }
+        invalidate(entities);
         return true;
     } else {
         qWarning() << "Failed to remove page" << id << query.lastError().databaseText() << "numRowsAffected" << query.numRowsAffected();
@@ -158,17 +345,17 @@ QList<Page *> SqlEngine::listPages(QObject *parent, int offset, int limit)
 {
     QList<Page *> ret;
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                               " created_at, updated_at, published_at, page, allow_comments, published "
+                QStringLiteral("SELECT id, uuid, path, title, author_id, content, content_z, html, format,"
+                               " created_at, updated_at, published_at, page, allow_comments, published, status "
                                "FROM posts "
-                               "WHERE page = 1 "
+                               "WHERE page "
                                "ORDER BY created_at DESC "
                                "LIMIT :limit OFFSET :offset"
                                ),
                 QStringLiteral("cmlyst"));
 
-    query.bindValue(QStringLiteral(":limit"), limit);
-    query.bindValue(QStringLiteral(":offset"), offset);
+    query.bindValue(QStringLiteral(":limit"), sqlLimit(limit));
+    query.bindValue(QStringLiteral(":offset"), qMax(0, offset));
     if (Q_LIKELY(query.exec())) {
         while (query.next()) {
             ret.append(createPageObj(query, parent));
@@ -181,17 +368,18 @@ QList<Page *> SqlEngine::listPagesPublished(QObject *parent, int offset, int lim
 {
     QList<Page *> ret;
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                               " created_at, updated_at, published_at, page, allow_comments, published "
+                QStringLiteral("SELECT id, uuid, path, title, author_id, html, format,"
+                               " CASE WHEN html IS NULL THEN content END AS content, CASE WHEN html IS NULL THEN content_z END AS content_z,"
+                               " created_at, updated_at, published_at, page, allow_comments, published, status "
                                "FROM posts "
-                               "WHERE page = 1 AND published = 1 "
+                               "WHERE page AND published "
                                "ORDER BY created_at DESC "
                                "LIMIT :limit OFFSET :offset"
                                ),
-                QStringLiteral("cmlyst"));
+                QStringLiteral("cmlyst_ro"));
 
-    query.bindValue(QStringLiteral(":limit"), limit);
-    query.bindValue(QStringLiteral(":offset"), offset);
+    query.bindValue(QStringLiteral(":limit"), sqlLimit(limit));
+    query.bindValue(QStringLiteral(":offset"), qMax(0, offset));
     if (Q_LIKELY(query.exec())) {
         while (query.next()) {
             ret.append(createPageObj(query, parent));
@@ -204,17 +392,17 @@ QList<Page *> SqlEngine::listPosts(QObject *parent, int offset, int limit)
 {
     QList<Page *> ret;
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                               " created_at, updated_at, published_at, page, allow_comments, published "
+                QStringLiteral("SELECT id, uuid, path, title, author_id, content, content_z, html, format,"
+                               " created_at, updated_at, published_at, page, allow_comments, published, status "
                                "FROM posts "
-                               "WHERE page = 0 "
+                               "WHERE NOT page "
                                "ORDER BY created_at DESC "
                                "LIMIT :limit OFFSET :offset"
                                ),
                 QStringLiteral("cmlyst"));
 
-    query.bindValue(QStringLiteral(":limit"), limit);
-    query.bindValue(QStringLiteral(":offset"), offset);
+    query.bindValue(QStringLiteral(":limit"), sqlLimit(limit));
+    query.bindValue(QStringLiteral(":offset"), qMax(0, offset));
     if (Q_LIKELY(query.exec())) {
         while (query.next()) {
             ret.append(createPageObj(query, parent));
@@ -227,17 +415,18 @@ QList<Page *> SqlEngine::listPostsPublished(QObject *parent, int offset, int lim
 {
     QList<Page *> ret;
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                               " created_at, updated_at, published_at, page, allow_comments, published "
+                QStringLiteral("SELECT id, uuid, path, title, author_id, html, format,"
+                               " CASE WHEN html IS NULL THEN content END AS content, CASE WHEN html IS NULL THEN content_z END AS content_z,"
+                               " created_at, updated_at, published_at, page, allow_comments, published, status "
                                "FROM posts "
-                               "WHERE page = 0 AND published = 1 "
+                               "WHERE NOT page AND published "
                                "ORDER BY published_at DESC "
                                "LIMIT :limit OFFSET :offset"
                                ),
-                QStringLiteral("cmlyst"));
+                QStringLiteral("cmlyst_ro"));
 
-    query.bindValue(QStringLiteral(":limit"), limit);
-    query.bindValue(QStringLiteral(":offset"), offset);
+    query.bindValue(QStringLiteral(":limit"), sqlLimit(limit));
+    query.bindValue(QStringLiteral(":offset"), qMax(0, offset));
     if (Q_LIKELY(query.exec())) {
         while (query.next()) {
             ret.append(createPageObj(query, parent));
@@ -250,18 +439,19 @@ QList<Page *> SqlEngine::listAuthorPostsPublished(QObject *parent, int authorId,
 {
     QList<Page *> ret;
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT id, uuid, path, title, author_id, content,"
-                               " created_at, updated_at, published_at, page, allow_comments, published "
+                QStringLiteral("SELECT id, uuid, path, title, author_id, html, format,"
+                               " CASE WHEN html IS NULL THEN content END AS content, CASE WHEN html IS NULL THEN content_z END AS content_z,"
+                               " created_at, updated_at, published_at, page, allow_comments, published, status "
                                "FROM posts "
-                               "WHERE page = 0 AND published = 1 AND author_id = :author_id "
+                               "WHERE NOT page AND published AND author_id = :author_id "
                                "ORDER BY created_at DESC "
                                "LIMIT :limit OFFSET :offset"
                                ),
-                QStringLiteral("cmlyst"));
+                QStringLiteral("cmlyst_ro"));
 
     query.bindValue(QStringLiteral(":author_id"), authorId);
-    query.bindValue(QStringLiteral(":limit"), limit);
-    query.bindValue(QStringLiteral(":offset"), offset);
+    query.bindValue(QStringLiteral(":limit"), sqlLimit(limit));
+    query.bindValue(QStringLiteral(":offset"), qMax(0, offset));
     if (query.exec()) {
         while (query.next()) {
             ret.append(createPageObj(query, parent));
@@ -287,33 +477,31 @@ bool SqlEngine::setSettingsValue(Cutelyst::Context *c, const QString &key, const
         return false;
     }
 
-    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT OR REPLACE INTO settings "
-                                                                  "(key, value) "
-                                                                  "VALUES "
-                                                                  "(:key, :value)"),
-                                                   QStringLiteral("cmlyst"));
+    if (key != QLatin1String("modified") && !saveSettingsValue(key, value)) {
+        db.rollback();
+        return false;
+    }
 
-    if (key != QLatin1String("modified")) {
-        query.bindValue(QStringLiteral(":key"), key);
-        query.bindValue(QStringLiteral(":value"), value);
-        if (!query.exec()) {
-            qWarning() << "Failed to save settings" << query.lastError().databaseText();
-            db.rollback();
-            return false;
-        }
+    // Settings, menus and users are reloaded when this changes, while
+    // content changes only start a new modified generation; "modified"
+    // itself is set when users change
+    if (touchModified(QStringLiteral("settings_modified")) == -1) {
+        db.rollback();
+        return false;
     }
 
-    qint64 currentDateTime = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch() / 1000;
-    query.bindValue(QStringLiteral(":key"), QStringLiteral("modified"));
-    query.bindValue(QStringLiteral(":value"), currentDateTime);
-    if (!query.exec()) {
-        qWarning() << "Failed to save settings" << query.lastError().databaseText();
+    QStringList entities;
+    if (key != QLatin1String("modified")) {
+        entities.append(QLatin1String("setting:") + key);
+    }
+    if (invalidate(entities) == -1) {
         db.rollback();
         return false;
     }
 
     if (db.commit()) {
         m_settingsDate = -1;
+        m_settingsGeneration = -1;
         m_settingsDateTime = QDateTime();
         c->setProperty("_sql_engine_date", QVariant());
         loadSettings(c);
@@ -323,6 +511,35 @@ bool SqlEngine::setSettingsValue(Cutelyst::Context *c, const QString &key, const
     return false;
 }
 
+bool SqlEngine::saveSettingsValue(const QString &key, const QString &value)
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE settings "
+                                                                  "SET value = :value "
+                                                                  "WHERE key = :key"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":key"), key);
+    query.bindValue(QStringLiteral(":value"), value);
+    if (!query.exec()) {
+        qWarning() << "Failed to save settings" << query.lastError().databaseText();
+        return false;
+    }
+
+    if (query.numRowsAffected() == 0) {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO settings "
+                                                            "(key, value) "
+                                                            "VALUES "
+                                                            "(:key, :value)"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":key"), key);
+        query.bindValue(QStringLiteral(":value"), value);
+        if (!query.exec()) {
+            qWarning() << "Failed to save settings" << query.lastError().databaseText();
+            return false;
+        }
+    }
+    return true;
+}
+
 QList<Menu *> SqlEngine::menus()
 {
     return m_menus;
@@ -392,46 +609,373 @@ bool SqlEngine::settingsIsWritable() const
 
 QHash<QString, QString> SqlEngine::loadSettings(Cutelyst::Context *c)
 {
-    QVariant loadedDate = c->property("_sql_engine_date");
-    if (loadedDate.isNull()) {
-        QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT value FROM settings WHERE key = 'modified'"),
-                                                       QStringLiteral("cmlyst"));
-        if (query.exec() && query.next()) {
-            loadedDate = query.value(0).toLongLong();
-            c->setProperty("_sql_engine_date", loadedDate);
+    // Only check for a new generation once per request
+    if (c->property("_sql_engine_date").isNull()) {
+        const qint64 settingsDate = refreshSettings();
+        if (settingsDate != -1) {
+            c->setProperty("_sql_engine_date", settingsDate);
         }
+    }
 
-        qint64 settingsDate = loadedDate.toLongLong();
-        if (settingsDate != m_settingsDate) {
-            m_settingsDate = settingsDate;
-            m_settingsDateTime = QDateTime::fromMSecsSinceEpoch(settingsDate * 1000);
-            m_settings.clear();
+    return m_settings;
+}
 
-            QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT key, value FROM settings"),
-                                                           QStringLiteral("cmlyst"));
-            if (query.exec()) {
-                while (query.next()) {
-                    m_settings.insert(query.value(0).toString(), query.value(1).toString());
-                }
+qint64 SqlEngine::refreshSettings()
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT key, value FROM settings "
+                                                                  "WHERE key IN ('modified', 'settings_modified')"),
+                                                   QStringLiteral("cmlyst_ro"));
+    if (!query.exec()) {
+        qWarning() << "Failed to get settings generation" << query.lastError().databaseText();
+        return -1;
+    }
+
+    qint64 settingsDate = 0;
+    qint64 settingsGeneration = 0;
+    while (query.next()) {
+        if (query.value(0).toString() == QLatin1String("modified")) {
+            settingsDate = query.value(1).toLongLong();
+        } else {
+            settingsGeneration = query.value(1).toLongLong();
+        }
+    }
+
+    if (settingsDate != m_settingsDate) {
+        if (m_settingsDate != -1) {
+            loadInvalidations(m_settingsDate);
+        }
+
+        // Content changes are seen through the invalidated outputs, and
+        // the path index is reloaded when a path is not found in it
+        m_settingsDate = settingsDate;
+        m_settingsDateTime = QDateTime::fromMSecsSinceEpoch(settingsDate * 1000);
+        m_settings.insert(QStringLiteral("modified"), QString::number(settingsDate));
+    }
+
+    if (settingsGeneration != m_settingsGeneration) {
+        m_settingsGeneration = settingsGeneration;
+        m_settings.clear();
+
+        QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT key, value FROM settings"),
+                                                       QStringLiteral("cmlyst_ro"));
+        if (query.exec()) {
+            while (query.next()) {
+                m_settings.insert(query.value(0).toString(), query.value(1).toString());
             }
+        }
+
+        const QString tz = m_settings.value(QStringLiteral("timezone"));
+        if (!tz.isEmpty()) {
+            m_timezone = QTimeZone(tz.toUtf8());
+        }
+
+        if (!m_timezone.isValid()) {
+            m_timezone = QTimeZone::systemTimeZone();
+        }
+
+        loadMenus();
+        loadUsers();
+        loadPathIndex();
+
+        delete m_siteContext;
+        m_siteContext = new SiteContext(m_settings, this);
 
-            const QString tz = m_settings.value(QStringLiteral("timezone"));
-            if (!tz.isEmpty()) {
-                m_timezone = QTimeZone(tz.toUtf8());
+        // Fragments only depend on settings
+        m_fragmentCache.clear();
+
+        // The view belongs to the application, it reloads the templates
+        const QString theme = m_settings.value(QStringLiteral("theme"), QStringLiteral("default"));
+        if (m_theme != theme) {
+            m_theme = theme;
+            Q_EMIT themeChanged(theme);
+        }
+    }
+
+    setReady(true);
+
+    return settingsDate;
+}
+
+void SqlEngine::loadInvalidations(qint64 sinceGeneration)
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT output FROM output_versions "
+                                                                  "WHERE generation > :generation"),
+                                                   QStringLiteral("cmlyst_ro"));
+    query.bindValue(QStringLiteral(":generation"), sinceGeneration);
+    if (!query.exec()) {
+        qWarning() << "Failed to load invalidated outputs" << query.lastError().databaseText();
+        return;
+    }
+
+    QStringList outputs;
+    while (query.next()) {
+        outputs.append(query.value(0).toString());
+    }
+
+    if (!outputs.isEmpty()) {
+        Q_EMIT outputsInvalidated(outputs);
+    }
+}
+
+bool SqlEngine::warmUp(Cutelyst::Application *app)
+{
+    Q_UNUSED(app)
+    if (refreshSettings() == -1) {
+        return false;
+    }
+
+    // Run the front page queries once so their statements are
+    // prepared and the pages they touch are in the page cache
+    const QList<Page *> posts = listPostsPublished(this, 0, siteContext()->postsPerPage());
+    qDeleteAll(posts);
+
+    if (m_settings.value(QStringLiteral("show_on_front"), QStringLiteral("posts")) != QLatin1String("posts")) {
+        delete getPage(m_settings.value(QStringLiteral("page_on_front")), this);
+    }
+
+    qDebug() << "Engine warmed up, generation" << m_settingsDate << "published paths" << m_publishedPaths.size();
+    return true;
+}
+
+bool SqlEngine::hasPublishedPath(const QString &path)
+{
+    if (m_publishedPaths.contains(path)) {
+        return true;
+    }
+
+    // Paths removed since are still found, posts are looked up anyway,
+    // but new ones are only seen by loading it again, once per generation
+    if (m_publishedPathsGeneration != m_settingsDate) {
+        loadPathIndex();
+    }
+    return !m_publishedPathsValid || m_publishedPaths.contains(path);
+}
+
+void SqlEngine::loadPathIndex()
+{
+    m_publishedPaths.clear();
+    m_publishedPathsGeneration = m_settingsDate;
+
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT path FROM posts WHERE published"),
+                                                   QStringLiteral("cmlyst_ro"));
+    m_publishedPathsValid = query.exec();
+    if (m_publishedPathsValid) {
+        while (query.next()) {
+            m_publishedPaths.insert(query.value(0).toString());
+        }
+    } else {
+        qWarning() << "Failed to load path index" << query.lastError().databaseText();
+    }
+}
+
+qint64 SqlEngine::touchModified(const QString &key)
+{
+    // Changes start a new generation, incrementing the previous
+    // value so two changes in the same second are never missed
+    const qint64 now = QDateTime::currentDateTimeUtc().toMSecsSinceEpoch() / 1000;
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE settings "
+                                                                  "SET value = CASE WHEN CAST(value AS BIGINT) >= :now "
+                                                                  "THEN CAST(value AS BIGINT) + 1 ELSE :now END "
+                                                                  "WHERE key = :key"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":now"), now);
+    query.bindValue(QStringLiteral(":key"), key);
+    if (!query.exec()) {
+        qWarning() << "Failed to update settings generation" << query.lastError().databaseText();
+        return -1;
+    }
+    // data_version doesn't count our own writes
+    markWrite();
+
+    if (query.numRowsAffected() == 0) {
+        return saveSettingsValue(key, QString::number(now)) ? now : -1;
+    }
+
+    query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT value FROM settings WHERE key = :key"),
+                                         QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":key"), key);
+    if (query.exec() && query.next()) {
+        const qint64 generation = query.value(0).toLongLong();
+        query.finish();
+        return generation;
+    }
+    return -1;
+}
+
+QStringList SqlEngine::postEntities(bool page, int authorId) const
+{
+    if (page) {
+        return { QStringLiteral("pages") };
+    }
+    return {
+        QStringLiteral("posts"),
+        QLatin1String("author-posts:") + QString::number(authorId)
+    };
+}
+
+qint64 SqlEngine::invalidate(const QStringList &entities, const QStringList &extraOutputs)
+{
+    const qint64 generation = touchModified();
+    if (generation == -1) {
+        return generation;
+    }
+    Q_EMIT generationStarted(generation);
+
+    if (entities.isEmpty() && extraOutputs.isEmpty()) {
+        return generation;
+    }
+
+    QSet<QString> outputs = extraOutputs.toSet();
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT output FROM output_deps WHERE dep = :dep"),
+                                                   QStringLiteral("cmlyst"));
+    for (const QString &entity : entities) {
+        query.bindValue(QStringLiteral(":dep"), entity);
+        if (!query.exec()) {
+            qWarning() << "Failed to get outputs depending on" << entity << query.lastError().databaseText();
+            continue;
+        }
+
+        while (query.next()) {
+            outputs.insert(query.value(0).toString());
+        }
+    }
+
+    // Outputs rendered here whose dependencies were not flushed yet
+    for (auto it = m_pendingOutputs.constBegin(); it != m_pendingOutputs.constEnd(); ++it) {
+        for (const QString &entity : entities) {
+            if (it.value().contains(entity)) {
+                outputs.insert(it.key());
+                break;
             }
+        }
+    }
 
-            if (!m_timezone.isValid()) {
-                m_timezone = QTimeZone::systemTimeZone();
+    // Outputs keep the generation they were last invalidated on, so other
+    // workers and the static exporter know what changed since they looked
+    QSqlQuery update = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE output_versions "
+                                                                   "SET generation = :generation "
+                                                                   "WHERE output = :output"),
+                                                    QStringLiteral("cmlyst"));
+    QSqlQuery insert = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO output_versions "
+                                                                   "(output, generation) "
+                                                                   "VALUES "
+                                                                   "(:output, :generation)"),
+                                                    QStringLiteral("cmlyst"));
+    for (const QString &output : outputs) {
+        update.bindValue(QStringLiteral(":output"), output);
+        update.bindValue(QStringLiteral(":generation"), generation);
+        if (update.exec() && update.numRowsAffected() == 0) {
+            insert.bindValue(QStringLiteral(":output"), output);
+            insert.bindValue(QStringLiteral(":generation"), generation);
+            if (!insert.exec()) {
+                qWarning() << "Failed to invalidate output" << output << insert.lastError().databaseText();
             }
+        }
+    }
+
+    qCDebug(CMS_SQLENGINE) << "Invalidated" << entities << "outputs" << outputs.size();
+    const QStringList outputList = outputs.toList();
+    if (!outputList.isEmpty()) {
+        Q_EMIT outputsInvalidated(outputList);
+    }
+    Q_EMIT contentChanged(entities, outputList);
 
-            loadMenus();
-            loadUsers();
+    return generation;
+}
+
+void SqlEngine::recordOutput(const QString &output, const QStringList &dependencies)
+{
+    // Each worker only writes an output dependencies once
+    // unless the rendered output starts depending on something else
+    const uint depsHash = qHash(dependencies);
+    auto it = m_recordedOutputs.constFind(output);
+    if (it != m_recordedOutputs.constEnd() && it.value() == depsHash) {
+        return;
+    }
+    m_recordedOutputs.insert(output, depsHash);
+    m_pendingOutputs.insert(output, dependencies);
+
+    if (!m_flushOutputsTimer) {
+        m_flushOutputsTimer = new QTimer(this);
+        m_flushOutputsTimer->setSingleShot(true);
+        m_flushOutputsTimer->setInterval(1000);
+        connect(m_flushOutputsTimer, &QTimer::timeout, this, &SqlEngine::flushOutputs);
+    }
+
+    if (!m_flushOutputsTimer->isActive()) {
+        m_flushOutputsTimer->start();
+    }
+}
 
-            configureView(c);
+bool SqlEngine::flushOutputs()
+{
+    if (m_pendingOutputs.isEmpty()) {
+        return true;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        qWarning() << "Failed to record output dependencies" << db.lastError().databaseText();
+        return false;
+    }
+
+    QSqlQuery remove = CPreparedSqlQueryThreadForDB(QStringLiteral("DELETE FROM output_deps WHERE output = :output"),
+                                                    QStringLiteral("cmlyst"));
+    QSqlQuery insert = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO output_deps "
+                                                                   "(output, dep) "
+                                                                   "VALUES "
+                                                                   "(:output, :dep)"),
+                                                    QStringLiteral("cmlyst"));
+    for (auto it = m_pendingOutputs.constBegin(); it != m_pendingOutputs.constEnd(); ++it) {
+        remove.bindValue(QStringLiteral(":output"), it.key());
+        if (!remove.exec()) {
+            qWarning() << "Failed to record output dependencies" << remove.lastError().databaseText();
+            db.rollback();
+            return false;
+        }
+
+        for (const QString &dep : it.value()) {
+            insert.bindValue(QStringLiteral(":output"), it.key());
+            insert.bindValue(QStringLiteral(":dep"), dep);
+            if (!insert.exec()) {
+                qWarning() << "Failed to record output dependencies" << insert.lastError().databaseText();
+                db.rollback();
+                return false;
+            }
         }
     }
 
-    return m_settings;
+    if (db.commit()) {
+        markWrite();
+        m_pendingOutputs.clear();
+        if (m_flushOutputsTimer) {
+            m_flushOutputsTimer->stop();
+        }
+        return true;
+    }
+    db.rollback();
+    return false;
+}
+
+void SqlEngine::markWrite()
+{
+    if (m_lastWrite.isValid()) {
+        m_lastWrite.restart();
+        m_truncated = false;
+    }
+}
+
+FragmentCache *SqlEngine::fragmentCache()
+{
+    return &m_fragmentCache;
+}
+
+SiteContext *SqlEngine::siteContext()
+{
+    if (!m_siteContext) {
+        m_siteContext = new SiteContext(m_settings, this);
+    }
+    return m_siteContext;
 }
 
 QDateTime SqlEngine::lastModified()
@@ -441,23 +985,6 @@ QDateTime SqlEngine::lastModified()
 
 QString SqlEngine::addUser(Cutelyst::Context *c, const Cutelyst::ParamsMultiMap &user, bool replace)
 {
-    QSqlQuery query;
-    if (replace) {
-        query = CPreparedSqlQueryThreadForDB(
-                    QStringLiteral("INSERT OR REPLACE INTO users "
-                                   "(slug, email, password, json) "
-                                   "VALUES "
-                                   "(:slug, :email, :password, :json)"),
-                    QStringLiteral("cmlyst"));
-    } else {
-        query = CPreparedSqlQueryThreadForDB(
-                    QStringLiteral("INSERT INTO users "
-                                   "(slug, email, password, json) "
-                                   "VALUES "
-                                   "(:slug, :email, :password, :json)"),
-                    QStringLiteral("cmlyst"));
-    }
-
     const QString name = user.value(QStringLiteral("name"));
     QString slug = name;
     if (slug.isEmpty()) {
@@ -465,6 +992,36 @@ QString SqlEngine::addUser(Cutelyst::Context *c, const Cutelyst::ParamsMultiMap
     }
     slug.remove(QRegularExpression(QStringLiteral("[^\\w]")));
     slug = slug.left(50).toLower().toHtmlEscaped();
+
+    // Replacing must not lose the user if adding it fails
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        qDebug() << "Failed to add new user:" << db.lastError().databaseText() << user;
+        return QString();
+    }
+
+    QSqlQuery query;
+    if (replace) {
+        // Same as INSERT OR REPLACE but portable to other databases
+        query = CPreparedSqlQueryThreadForDB(
+                    QStringLiteral("DELETE FROM users "
+                                   "WHERE slug = :slug OR email = :email"),
+                    QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":slug"), slug);
+        query.bindValue(QStringLiteral(":email"), user.value(QStringLiteral("email")));
+        if (!query.exec()) {
+            qDebug() << "Failed to replace user:" << query.lastError().databaseText() << user;
+            db.rollback();
+            return QString();
+        }
+    }
+
+    query = CPreparedSqlQueryThreadForDB(
+                QStringLiteral("INSERT INTO users "
+                               "(slug, email, password, json) "
+                               "VALUES "
+                               "(:slug, :email, :password, :json)"),
+                QStringLiteral("cmlyst"));
     query.bindValue(QStringLiteral(":slug"), slug);
 
     query.bindValue(QStringLiteral(":email"), user.value(QStringLiteral("email")));
@@ -475,8 +1032,9 @@ QString SqlEngine::addUser(Cutelyst::Context *c, const Cutelyst::ParamsMultiMap
                name.left(150).toHtmlEscaped());
     query.bindValue(QStringLiteral(":json"), QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Compact)));
 
-    if (!query.exec()) {
-        qDebug() << "Failed to add new user:" << query.lastError().databaseText() << user;
+    if (!query.exec() || !db.commit()) {
+        qDebug() << "Failed to add new user:" << query.lastError().databaseText() << db.lastError().databaseText() << user;
+        db.rollback();
         return QString();
     }
 
@@ -492,7 +1050,13 @@ bool SqlEngine::removeUser(Cutelyst::Context *c, int id)
                 QStringLiteral("cmlyst"));
     query.bindValue(QStringLiteral(":id"), id);
     if (query.exec() && query.numRowsAffected() == 1) {
-        setSettingsValue(c, QStringLiteral("modified"), QString());
+        // Users are reloaded with settings
+        touchModified(QStringLiteral("settings_modified"));
+        m_settingsGeneration = -1;
+        invalidate({
+                       QLatin1String("author:") + QString::number(id),
+                       QLatin1String("author-posts:") + QString::number(id)
+                   });
         return true;
     }
     return false;
@@ -513,22 +1077,131 @@ QHash<QString, QString> SqlEngine::user(int id)
     return m_usersId.value(id);
 }
 
+bool SqlEngine::backup(const QString &destination, bool compress)
+{
+    SqliteBackup backup;
+    return backup.backup(m_dbPath, destination, compress);
+}
+
+bool SqlEngine::restore(const QString &source)
+{
+    // The restored database doesn't know the outputs
+    // rendered after the backup was made
+    const QStringList keys = { QStringLiteral("modified"), QStringLiteral("settings_modified") };
+    QList<qint64> previous;
+    for (const QString &key : keys) {
+        previous.append(storedGeneration(key));
+    }
+    QStringList outputs = recordedOutputs();
+
+    // Older schemas are migrated once copied, newer ones are refused
+    SqliteBackup backup;
+    backup.setMaxUserVersion(schemaVersion());
+    if (!backup.restore(source, m_dbPath) || !setupSchema()) {
+        return false;
+    }
+
+    // Other workers compare generations, so they must not go back
+    for (int i = 0; i < keys.size(); ++i) {
+        if (previous.at(i) > storedGeneration(keys.at(i)) &&
+                !saveSettingsValue(keys.at(i), QString::number(previous.at(i)))) {
+            return false;
+        }
+    }
+
+    // Makes every worker reload settings, menus and users
+    if (touchModified(QStringLiteral("settings_modified")) == -1) {
+        return false;
+    }
+
+    for (const QString &output : recordedOutputs()) {
+        if (!outputs.contains(output)) {
+            outputs.append(output);
+        }
+    }
+
+    m_settingsDate = -1;
+    m_settingsGeneration = -1;
+    m_settingsDateTime = QDateTime();
+    m_recordedOutputs.clear();
+    return invalidate(QStringList(), outputs) != -1;
+}
+
+qint64 SqlEngine::storedGeneration(const QString &key)
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT value FROM settings WHERE key = :key"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":key"), key);
+    if (query.exec() && query.next()) {
+        const qint64 generation = query.value(0).toLongLong();
+        query.finish();
+        return generation;
+    }
+    return 0;
+}
+
+QStringList SqlEngine::recordedOutputs()
+{
+    QStringList ret;
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT DISTINCT output FROM output_deps"),
+                                                   QStringLiteral("cmlyst"));
+    if (query.exec()) {
+        while (query.next()) {
+            ret.append(query.value(0).toString());
+        }
+    } else {
+        qWarning() << "Failed to list rendered outputs" << query.lastError().databaseText();
+    }
+    return ret;
+}
+
 int SqlEngine::savePageBackend(Page *page)
 {
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        qWarning() << "Failed to save page" << db.lastError().databaseText();
+        return 0;
+    }
+
+    // What is being replaced, the new revision is stored against it
+    QString previous;
+    QString previousTitle;
+    int previousAuthor = 0;
+    QDateTime previousUpdated;
+    bool replaced = false;
+    bool previousPage = false;
+    bool previousPublished = false;
     QSqlQuery query;
+    if (page->id()) {
+        query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT content, title, author_id, updated_at, content_z, page, published FROM posts "
+                                                            "WHERE id = :id"),
+                                             QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":id"), page->id());
+        if (query.exec() && query.next()) {
+            previous = ContentCodec::content(query.value(0), query.value(4));
+            previousTitle = query.value(1).toString();
+            previousAuthor = query.value(2).toInt();
+            previousUpdated = fromSqlDateTime(query.value(3));
+            previousPage = query.value(5).toBool();
+            previousPublished = query.value(6).toBool();
+            replaced = true;
+        }
+        query.finish();
+    }
+
     if (!page->id()) {
         query = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO posts "
-                                                            "(path, uuid, title, author_id, content, html,"
-                                                            " created_at, updated_at, published_at, page, published, allow_comments, published) "
+                                                            "(path, uuid, title, author_id, content, content_z, html, format,"
+                                                            " created_at, updated_at, published_at, page, published, status, allow_comments) "
                                                             "VALUES "
-                                                            "(:path, :uuid, :title, :author_id, :content, :html,"
-                                                            " :created_at, :updated_at, :published_at, :page, :published, :allow_comments, :published)"),
+                                                            "(:path, :uuid, :title, :author_id, :content, :content_z, :html, :format,"
+                                                            " :created_at, :updated_at, :published_at, :page, :published, :status, :allow_comments)"),
                                              QStringLiteral("cmlyst"));
     } else {
         query = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE posts SET "
-                                                            "path = :path, title = :title, author_id = :author_id, content = :content, html = :html, "
+                                                            "path = :path, title = :title, author_id = :author_id, content = :content, content_z = :content_z, html = :html, format = :format, "
                                                             "created_at = :created_at, updated_at = :updated_at, published_at = :published_at,"
-                                                            "page = :page, published = :published, allow_comments = :allow_comments, published = :published "
+                                                            "page = :page, published = :published, status = :status, allow_comments = :allow_comments "
                                                             "WHERE id = :id"),
                                              QStringLiteral("cmlyst"));
         query.bindValue(QStringLiteral(":id"), page->id());
@@ -538,24 +1211,285 @@ int SqlEngine::savePageBackend(Page *page)
     query.bindValue(QStringLiteral(":uuid"), page->uuid());
     query.bindValue(QStringLiteral(":title"), page->title());
     query.bindValue(QStringLiteral(":author_id"), page->author().value(QStringLiteral("id")).toInt());
-    query.bindValue(QStringLiteral(":content"), page->content().get());
-    query.bindValue(QStringLiteral(":html"), page->content().get());
-    query.bindValue(QStringLiteral(":created_at"), page->created().toUTC().toString(QStringLiteral("yyyy-MM-dd HH:mm:ss")));
-    query.bindValue(QStringLiteral(":updated_at"), page->updated().toUTC().toString(QStringLiteral("yyyy-MM-dd HH:mm:ss")));
-    query.bindValue(QStringLiteral(":published_at"), page->publishedAt().toUTC().toString(QStringLiteral("yyyy-MM-dd HH:mm:ss")));
+    // Markdown is rendered once here, the front end only reads html
+    const QString content = page->source();
+    const bool markdown = page->format() == QLatin1String("markdown");
+    const QString html = markdown ? Markdown::toHtml(content) : content;
+    page->setContent(html, true);
+    // Large bodies are only stored compressed
+    const QByteArray compressed = content.size() >= m_compressThreshold ? ContentCodec::compress(content) : QByteArray();
+    query.bindValue(QStringLiteral(":content"), compressed.isEmpty() ? QVariant(content) : QVariant(QVariant::String));
+    query.bindValue(QStringLiteral(":content_z"), compressed.isEmpty() ? QVariant(QVariant::ByteArray) : QVariant(compressed));
+    query.bindValue(QStringLiteral(":html"), markdown ? QVariant(html) : QVariant(QVariant::String));
+    query.bindValue(QStringLiteral(":format"), markdown ? QVariant(page->format()) : QVariant(QVariant::String));
+    query.bindValue(QStringLiteral(":created_at"), toSqlDateTime(page->created()));
+    query.bindValue(QStringLiteral(":updated_at"), toSqlDateTime(page->updated()));
+    query.bindValue(QStringLiteral(":published_at"), toSqlDateTime(page->publishedAt()));
     query.bindValue(QStringLiteral(":page"), page->page());
     query.bindValue(QStringLiteral(":published"), page->published());
+    query.bindValue(QStringLiteral(":status"), page->scheduled() && !page->published() ?
+                        QVariant(QStringLiteral("scheduled")) : QVariant(QVariant::String));
     query.bindValue(QStringLiteral(":allow_comments"), page->allowComments());
-    query.bindValue(QStringLiteral(":published"), page->published());
     if (!query.exec()) {
         qWarning() << "Failed to save page" << query.lastError().databaseText();
+        db.rollback();
         return 0;
     }
 
-    if (page->id()) {
-        return page->id();
+    const int id = page->id() ? page->id() : query.lastInsertId().toInt();
+    if (!saveRevision(id, previous, previousTitle, previousAuthor, previousUpdated, page) || !db.commit()) {
+        qWarning() << "Failed to save page revision" << id << db.lastError().databaseText();
+        db.rollback();
+        return 0;
+    }
+
+    // Drafts are on no list, saving them only touches their own outputs
+    QStringList entities = { QLatin1String("post:") + QString::number(id) };
+    if (page->published()) {
+        entities.append(postEntities(page->page(), page->author().value(QStringLiteral("id")).toInt()));
+    }
+    if (replaced && previousPublished) {
+        // Lists it was shown on before moving to another author or kind
+        entities.append(postEntities(previousPage, previousAuthor));
+        entities.removeDuplicates();
+    }
+    invalidate(entities);
+
+    // The time may have been moved or the post unscheduled
+    scheduleNextPublish();
+
+    return id;
+}
+
+bool SqlEngine::saveRevision(int id, const QString &previous, const QString &previousTitle, int previousAuthor,
+                             const QDateTime &previousUpdated, Page *page)
+{
+    const QString content = page->source();
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT revision, base FROM revisions "
+                                                                  "WHERE post_id = :post_id "
+                                                                  "ORDER BY revision DESC "
+                                                                  "LIMIT 1"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":post_id"), id);
+    if (!query.exec()) {
+        return false;
+    }
+
+    int revision = 0;
+    int base = 0;
+    if (query.next()) {
+        revision = query.value(0).toInt();
+        base = query.value(1).toInt();
+    }
+    query.finish();
+
+    QSqlQuery insert = CPreparedSqlQueryThreadForDB(QStringLiteral("INSERT INTO revisions "
+                                                                   "(post_id, revision, base, prefix, suffix, data, size, title, author_id, created_at) "
+                                                                   "VALUES "
+                                                                   "(:post_id, :revision, :base, :prefix, :suffix, :data, :size, :title, :author_id, :created_at)"),
+                                                    QStringLiteral("cmlyst"));
+    insert.bindValue(QStringLiteral(":post_id"), id);
+
+    // Pages saved before revisions existed start with what they had
+    if (revision == 0 && !previous.isNull()) {
+        if (previous == content && previousTitle == page->title()) {
+            return true;
+        }
+
+        base = revision = 1;
+        insert.bindValue(QStringLiteral(":revision"), revision);
+        insert.bindValue(QStringLiteral(":base"), base);
+        insert.bindValue(QStringLiteral(":prefix"), 0);
+        insert.bindValue(QStringLiteral(":suffix"), 0);
+        insert.bindValue(QStringLiteral(":data"), qCompress(previous.toUtf8()));
+        insert.bindValue(QStringLiteral(":size"), previous.size());
+        insert.bindValue(QStringLiteral(":title"), previousTitle);
+        insert.bindValue(QStringLiteral(":author_id"), previousAuthor);
+        insert.bindValue(QStringLiteral(":created_at"), toSqlDateTime(previousUpdated.isValid() ? previousUpdated : QDateTime::currentDateTimeUtc()));
+        if (!insert.exec()) {
+            return false;
+        }
+    } else if (revision && previous == content && previousTitle == page->title()) {
+        // Publishing and other changes that don't touch the text
+        return true;
+    }
+
+    // Mostly rewritten texts and long chains get a full copy,
+    // so restoring never replays more than the interval
+    const TextDelta delta = TextDelta::make(previous, content);
+    const bool snapshot = revision == 0 || revision + 1 - base >= m_revisionInterval ||
+            delta.middle.size() > content.size() / 2;
+    ++revision;
+    if (snapshot) {
+        base = revision;
+    }
+
+    insert.bindValue(QStringLiteral(":revision"), revision);
+    insert.bindValue(QStringLiteral(":base"), base);
+    insert.bindValue(QStringLiteral(":prefix"), snapshot ? 0 : delta.prefix);
+    insert.bindValue(QStringLiteral(":suffix"), snapshot ? 0 : delta.suffix);
+    insert.bindValue(QStringLiteral(":data"), snapshot ? qCompress(content.toUtf8()) : delta.data());
+    insert.bindValue(QStringLiteral(":size"), content.size());
+    insert.bindValue(QStringLiteral(":title"), page->title());
+    insert.bindValue(QStringLiteral(":author_id"), page->author().value(QStringLiteral("id")).toInt());
+    insert.bindValue(QStringLiteral(":created_at"), toSqlDateTime(QDateTime::currentDateTimeUtc()));
+    return insert.exec();
+}
+
+QVariantList SqlEngine::revisions(int pageId)
+{
+    QVariantList ret;
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT revision, base, size, title, author_id, created_at "
+                                                                  "FROM revisions "
+                                                                  "WHERE post_id = :post_id "
+                                                                  "ORDER BY revision DESC"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":post_id"), pageId);
+    if (!query.exec()) {
+        qWarning() << "Failed to list revisions" << pageId << query.lastError().databaseText();
+        return ret;
+    }
+
+    while (query.next()) {
+        QDateTime created = fromSqlDateTime(query.value(5)).toTimeZone(m_timezone);
+        created.setTimeSpec(Qt::LocalTime);
+        ret.append(QVariantHash{
+                       {QStringLiteral("revision"), query.value(0).toInt()},
+                       {QStringLiteral("snapshot"), query.value(0).toInt() == query.value(1).toInt()},
+                       {QStringLiteral("size"), query.value(2).toInt()},
+                       {QStringLiteral("title"), query.value(3).toString()},
+                       {QStringLiteral("author"), QVariant::fromValue(m_usersId.value(query.value(4).toInt()))},
+                       {QStringLiteral("created_at"), created},
+                   });
+    }
+    return ret;
+}
+
+bool SqlEngine::revision(int pageId, int revision, QString *title, QString *content)
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT r.revision, r.prefix, r.suffix, r.data, r.title "
+                                                                  "FROM revisions r "
+                                                                  "JOIN revisions t ON t.post_id = r.post_id AND t.revision = :revision "
+                                                                  "WHERE r.post_id = :post_id AND r.revision BETWEEN t.base AND t.revision "
+                                                                  "ORDER BY r.revision"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":post_id"), pageId);
+    query.bindValue(QStringLiteral(":revision"), revision);
+    if (!query.exec()) {
+        qWarning() << "Failed to get revision" << pageId << revision << query.lastError().databaseText();
+        return false;
     }
-    return query.lastInsertId().toInt();
+
+    // The first row is the full copy the others apply to
+    bool found = false;
+    while (query.next()) {
+        if (!found) {
+            *content = QString::fromUtf8(qUncompress(query.value(3).toByteArray()));
+            found = true;
+        } else {
+            *content = TextDelta::fromData(query.value(1).toInt(), query.value(2).toInt(), query.value(3).toByteArray()).apply(*content);
+        }
+        *title = query.value(4).toString();
+    }
+    return found;
+}
+
+void SqlEngine::setRevisionSnapshotInterval(int revisions)
+{
+    m_revisionInterval = qMax(1, revisions);
+}
+
+int SqlEngine::publishScheduled(QString *error)
+{
+    // Either all of them are published and invalidated or
+    // none is, so a retry finds them still scheduled
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        *error = db.lastError().databaseText();
+        return -1;
+    }
+
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, page, author_id FROM posts "
+                                                                  "WHERE status = 'scheduled' AND published_at <= :now"),
+                                                   QStringLiteral("cmlyst"));
+    query.bindValue(QStringLiteral(":now"), toSqlDateTime(QDateTime::currentDateTimeUtc()));
+    if (!query.exec()) {
+        *error = query.lastError().databaseText();
+        db.rollback();
+        return -1;
+    }
+
+    QVector<int> ids;
+    QStringList entities;
+    while (query.next()) {
+        const int id = query.value(0).toInt();
+        ids.append(id);
+        entities.append(QLatin1String("post:") + QString::number(id));
+        for (const QString &entity : postEntities(query.value(1).toBool(), query.value(2).toInt())) {
+            if (!entities.contains(entity)) {
+                entities.append(entity);
+            }
+        }
+    }
+    query.finish();
+
+    QSqlQuery update = CPreparedSqlQueryThreadForDB(QStringLiteral("UPDATE posts "
+                                                                   "SET published = :published, status = NULL "
+                                                                   "WHERE id = :id AND status = 'scheduled'"),
+                                                    QStringLiteral("cmlyst"));
+    int published = 0;
+    for (int id : ids) {
+        update.bindValue(QStringLiteral(":published"), true);
+        update.bindValue(QStringLiteral(":id"), id);
+        if (!update.exec()) {
+            *error = update.lastError().databaseText();
+            db.rollback();
+            return -1;
+        }
+        published += update.numRowsAffected();
+    }
+
+    if (!db.commit()) {
+        *error = db.lastError().databaseText();
+        db.rollback();
+        return -1;
+    }
+
+    // All at once so caches, feeds and counts change at that instant
+    if (published) {
+        qDebug() << "Published scheduled posts" << ids;
+        invalidate(entities);
+    }
+
+    scheduleNextPublish();
+    return published;
+}
+
+bool SqlEngine::invalidateMedia(const QString &hash)
+{
+    return invalidate({ QLatin1String("media:") + hash }) != -1;
+}
+
+void SqlEngine::scheduleNextPublish()
+{
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT min(published_at) FROM posts "
+                                                                  "WHERE status = 'scheduled'"),
+                                                   QStringLiteral("cmlyst"));
+    if (!query.exec() || !query.next()) {
+        qWarning() << "Failed to get next scheduled post" << query.lastError().databaseText();
+        return;
+    }
+
+    if (!query.value(0).isNull()) {
+        const QDateTime next = fromSqlDateTime(query.value(0));
+        query.finish();
+        JobScheduler::enqueue(QStringLiteral("publish-scheduled"), QJsonObject(), 10, next, QStringLiteral("publish-scheduled"));
+    }
+}
+
+QTimeZone SqlEngine::timeZone() const
+{
+    return m_timezone;
 }
 
 void SqlEngine::loadMenus()
@@ -618,7 +1552,7 @@ void SqlEngine::loadUsers()
     m_usersId.clear();
     QSqlQuery query = CPreparedSqlQueryThreadForDB(QStringLiteral("SELECT id, slug, email, json "
                                                                   "FROM users "),
-                                                   QStringLiteral("cmlyst"));
+                                                   QStringLiteral("cmlyst_ro"));
     if (Q_LIKELY(query.exec())) {
         while (query.next()) {
             QHash<QString, QString> user;
@@ -655,55 +1589,79 @@ void SqlEngine::loadUsers()
     }
 }
 
-void SqlEngine::configureView(Cutelyst::Context *c)
+bool SqlEngine::setupSchema()
 {
-    const QString theme = m_settings.value(QStringLiteral("theme"), QStringLiteral("default"));
-
-    if (m_theme != theme) {
-        m_theme = theme;
+    // Every worker process and thread gets here at the same time,
+    // the first one creates or migrates and the others find it done
+    if (!lockSchema()) {
+        return false;
+    }
 
-        Cutelyst::Application *app = c->app();
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    const bool ret = (db.tables().contains(QStringLiteral("posts")) || createDb()) && migrateDb();
+    unlockSchema();
+    return ret;
+}
 
-        auto view = qobject_cast<Cutelyst::GrantleeView*>(app->view());
+bool SqlEngine::lockSchema()
+{
+    m_schemaLockFd = ::open(QFile::encodeName(m_schemaLockPath).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (m_schemaLockFd == -1) {
+        qCritical() << "Failed to open schema lock" << m_schemaLockPath << strerror(errno);
+        return false;
+    }
 
-        const QDir themeDir = app->pathTo(QStringLiteral("root/themes"));
+    int ret;
+    do {
+        ret = flock(m_schemaLockFd, LOCK_EX);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        qCritical() << "Failed to lock schema" << m_schemaLockPath << strerror(errno);
+        ::close(m_schemaLockFd);
+        m_schemaLockFd = -1;
+        return false;
+    }
+    return true;
+}
 
-        view->setIncludePaths({ themeDir.absoluteFilePath(theme) });
+void SqlEngine::unlockSchema()
+{
+    if (m_schemaLockFd != -1) {
+        // Closing releases the lock
+        ::close(m_schemaLockFd);
+        m_schemaLockFd = -1;
     }
 }
 
-void SqlEngine::createDb()
+bool SqlEngine::createDb()
 {
     QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
     qDebug() << "createDb";
 
-    bool ret = query.exec(QStringLiteral("PRAGMA journal_mode = WAL"));
-    qDebug() << "PRAGMA journal_mode = WAL" << ret << query.lastError().databaseText();
-
-    if (!query.exec(QStringLiteral("CREATE TABLE posts "
-                                   "( id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT"
-                                   ", uuid TEXT NOT NULL UNIQUE "
-                                   ", path TEXT NOT NULL UNIQUE "
-                                   ", title TEXT "
-                                   ", content TEXT "
-                                   ", html TEXT "
-                                   ", language TEXT "
-                                   ", status TEXT "
-                                   ", meta_title TEXT "
-                                   ", meta_description TEXT "
-                                   ", page BOOL NOT NULL "
-                                   ", published BOOL NOT NULL "
-                                   ", allow_comments BOOL NOT NULL "
-                                   ", author_id INTEGER "
-                                   ", created_at datetime NOT NULL "
-                                   ", created_by INTEGER "
-                                   ", updated_at datetime "
-                                   ", updated_by INTEGER "
-                                   ", published_at datetime "
-                                   ", published_by INTEGER "
-                                   ")"))) {
+    if (!query.exec(QLatin1String("CREATE TABLE posts "
+                                  "( id ") + autoIncrementKey() + QLatin1String(
+                                  ", uuid TEXT NOT NULL UNIQUE "
+                                  ", path TEXT NOT NULL UNIQUE "
+                                  ", title TEXT "
+                                  ", content TEXT "
+                                  ", html TEXT "
+                                  ", language TEXT "
+                                  ", status TEXT "
+                                  ", meta_title TEXT "
+                                  ", meta_description TEXT "
+                                  ", page BOOL NOT NULL "
+                                  ", published BOOL NOT NULL "
+                                  ", allow_comments BOOL NOT NULL "
+                                  ", author_id INTEGER "
+                                  ", created_at ") + dateTimeType() + QLatin1String(" NOT NULL "
+                                  ", created_by INTEGER "
+                                  ", updated_at ") + dateTimeType() + QLatin1String(
+                                  ", updated_by INTEGER "
+                                  ", published_at ") + dateTimeType() + QLatin1String(
+                                  ", published_by INTEGER "
+                                  ")"))) {
         qCritical() << "Error creating database" << query.lastError().text();
-        exit(1);
+        return false;
     }
 
     if (!query.exec(QStringLiteral("CREATE TABLE settings "
@@ -711,17 +1669,229 @@ void SqlEngine::createDb()
                                    ", value TEXT"
                                    ")"))) {
         qCritical() << "Error creating database" << query.lastError().text();
-        exit(1);
+        return false;
     }
 
-    if (!query.exec(QStringLiteral("CREATE TABLE users "
-                                   "( id INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT "
-                                   ", slug TEXT NOT NULL UNIQUE "
-                                   ", email TEXT NOT NULL UNIQUE "
-                                   ", password TEXT NOT NULL "
-                                   ", json TEXT "
-                                   ")"))) {
+    if (!query.exec(QLatin1String("CREATE TABLE users "
+                                  "( id ") + autoIncrementKey() + QLatin1String(
+                                  ", slug TEXT NOT NULL UNIQUE "
+                                  ", email TEXT NOT NULL UNIQUE "
+                                  ", password TEXT NOT NULL "
+                                  ", json TEXT "
+                                  ")"))) {
         qCritical() << "Error creating database" << query.lastError().text();
-        exit(1);
+        return false;
     }
+
+    qDebug() << "Database tables created";
+    return setSchemaVersion(1);
+}
+
+bool SqlEngine::migrateDb()
+{
+    // Each entry brings the schema from version N + 1 to N + 2,
+    // the tables created by createDb() are version 1
+    const QVector<QStringList> migrations = {
+        {
+            QStringLiteral("CREATE INDEX posts_listing ON posts (page, published, created_at)"),
+            QStringLiteral("CREATE INDEX posts_author ON posts (author_id)"),
+        },
+        {
+            QStringLiteral("CREATE TABLE output_deps "
+                           "( output TEXT NOT NULL "
+                           ", dep TEXT NOT NULL "
+                           ", PRIMARY KEY (output, dep) "
+                           ")"),
+            QStringLiteral("CREATE INDEX output_deps_dep ON output_deps (dep)"),
+            QStringLiteral("CREATE TABLE output_versions "
+                           "( output TEXT NOT NULL PRIMARY KEY "
+                           ", generation BIGINT NOT NULL "
+                           ")"),
+            QStringLiteral("CREATE INDEX output_versions_generation ON output_versions (generation)"),
+        },
+        {
+            QLatin1String("CREATE TABLE media_blobs "
+                          "( hash TEXT NOT NULL PRIMARY KEY "
+                          ", size BIGINT NOT NULL "
+                          ", refcount INTEGER NOT NULL "
+                          ", created_at ") + dateTimeType() + QLatin1String(" NOT NULL "
+                          ")"),
+            QLatin1String("CREATE TABLE media "
+                          "( id ") + autoIncrementKey() + QLatin1String(
+                          ", name TEXT NOT NULL UNIQUE "
+                          ", hash TEXT NOT NULL REFERENCES media_blobs(hash) "
+                          ", created_at ") + dateTimeType() + QLatin1String(" NOT NULL "
+                          ")"),
+            QStringLiteral("CREATE INDEX media_hash ON media (hash)"),
+        },
+        {
+            QStringLiteral("ALTER TABLE media_blobs ADD COLUMN mime TEXT"),
+            QStringLiteral("ALTER TABLE media_blobs ADD COLUMN width INTEGER"),
+            QStringLiteral("ALTER TABLE media_blobs ADD COLUMN height INTEGER"),
+            QStringLiteral("CREATE INDEX media_created ON media (created_at)"),
+        },
+        {
+            QLatin1String("CREATE TABLE jobs "
+                          "( id ") + autoIncrementKey() + QLatin1String(
+                          ", type TEXT NOT NULL "
+                          ", payload TEXT "
+                          ", unique_key TEXT "
+                          ", priority INTEGER NOT NULL "
+                          ", status TEXT NOT NULL "
+                          ", attempts INTEGER NOT NULL "
+                          ", run_at BIGINT NOT NULL "
+                          ", last_error TEXT "
+                          ", created_at ") + dateTimeType() + QLatin1String(" NOT NULL "
+                          ")"),
+            QStringLiteral("CREATE INDEX jobs_pending ON jobs (status, run_at)"),
+            QStringLiteral("CREATE INDEX jobs_unique_key ON jobs (unique_key)"),
+        },
+        {
+            QStringLiteral("CREATE INDEX posts_status ON posts (status, published_at)"),
+        },
+        {
+            QLatin1String("CREATE TABLE revisions "
+                          "( post_id INTEGER NOT NULL "
+                          ", revision INTEGER NOT NULL "
+                          ", base INTEGER NOT NULL "
+                          ", prefix INTEGER NOT NULL "
+                          ", suffix INTEGER NOT NULL "
+                          ", data ") + blobType() + QLatin1String(
+                          ", size INTEGER NOT NULL "
+                          ", title TEXT "
+                          ", author_id INTEGER "
+                          ", created_at ") + dateTimeType() + QLatin1String(" NOT NULL "
+                          ", PRIMARY KEY (post_id, revision) "
+                          ")"),
+        },
+        {
+            QLatin1String("ALTER TABLE posts ADD COLUMN content_z ") + blobType(),
+            QStringLiteral("UPDATE posts SET html = NULL"),
+        },
+        {
+            QStringLiteral("ALTER TABLE posts ADD COLUMN format TEXT"),
+        },
+    };
+
+    int version = schemaVersion();
+    if (version < 1) {
+        return false;
+    }
+
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    while (version <= migrations.size()) {
+        if (!db.transaction()) {
+            qCritical() << "Failed to start migration" << db.lastError().databaseText();
+            return false;
+        }
+
+        QSqlQuery query(db);
+        Q_FOREACH (const QString &statement, migrations.at(version - 1)) {
+            if (!query.exec(statement)) {
+                qCritical() << "Failed to migrate database to version" << version + 1
+                            << query.lastError().databaseText();
+                db.rollback();
+                return false;
+            }
+        }
+
+        // Data changes that can't be written as SQL
+        if (version + 1 == 9 && !compressContents()) {
+            qCritical() << "Failed to migrate database to version" << version + 1;
+            db.rollback();
+            return false;
+        }
+
+        if (!setSchemaVersion(++version) || !db.commit()) {
+            qCritical() << "Failed to migrate database to version" << version << db.lastError().databaseText();
+            db.rollback();
+            return false;
+        }
+        qDebug() << "Database migrated to version" << version;
+    }
+
+    return true;
+}
+
+bool SqlEngine::compressContents()
+{
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    query.setForwardOnly(true);
+    if (!query.exec(QStringLiteral("SELECT id, content FROM posts WHERE content IS NOT NULL"))) {
+        qCritical() << "Failed to read posts to compress" << query.lastError().databaseText();
+        return false;
+    }
+
+    QVector<QPair<int, QByteArray> > compressed;
+    while (query.next()) {
+        const QString content = query.value(1).toString();
+        if (content.size() >= m_compressThreshold) {
+            const QByteArray data = ContentCodec::compress(content);
+            if (!data.isEmpty()) {
+                compressed.append(qMakePair(query.value(0).toInt(), data));
+            }
+        }
+    }
+    query.finish();
+
+    QSqlQuery update(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    update.prepare(QStringLiteral("UPDATE posts SET content = NULL, content_z = :content_z WHERE id = :id"));
+    for (const auto &row : compressed) {
+        update.bindValue(QStringLiteral(":content_z"), row.second);
+        update.bindValue(QStringLiteral(":id"), row.first);
+        if (!update.exec()) {
+            qCritical() << "Failed to compress post" << row.first << update.lastError().databaseText();
+            return false;
+        }
+    }
+
+    qDebug() << "Compressed" << compressed.size() << "posts";
+    return true;
+}
+
+void SqlEngine::setContentCompressThreshold(int characters)
+{
+    m_compressThreshold = characters;
+}
+
+int SqlEngine::schemaVersion()
+{
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    if (!query.exec(QStringLiteral("PRAGMA user_version")) || !query.next()) {
+        qCritical() << "Failed to get schema version" << query.lastError().databaseText();
+        return -1;
+    }
+
+    // Databases created before versioning have the tables but no version
+    return qMax(1, query.value(0).toInt());
+}
+
+bool SqlEngine::setSchemaVersion(int version)
+{
+    QSqlQuery query(QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst"))));
+    if (!query.exec(QLatin1String("PRAGMA user_version = ") + QString::number(version))) {
+        qCritical() << "Failed to set schema version" << query.lastError().databaseText();
+        return false;
+    }
+    return true;
+}
+
+QVariant SqlEngine::sqlLimit(int limit) const
+{
+    return limit;
+}
+
+QString SqlEngine::autoIncrementKey() const
+{
+    return QStringLiteral("INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT");
+}
+
+QString SqlEngine::dateTimeType() const
+{
+    return QStringLiteral("datetime");
+}
+
+QString SqlEngine::blobType() const
+{
+    return QStringLiteral("BLOB");
 }
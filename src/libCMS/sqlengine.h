@@ -4,13 +4,19 @@
 #include <QObject>
 #include <QDateTime>
 #include <QTimeZone>
+#include <QElapsedTimer>
+#include <QSet>
 
 #include "engine.h"
+#include "fragmentcache.h"
 
 class QSqlQuery;
+class QSqlDatabase;
+class QTimer;
 
 namespace Cutelyst {
 class Context;
+class Application;
 }
 
 namespace CMS {
@@ -71,24 +77,148 @@ public:
 
     QHash<QString, QString> loadSettings(Cutelyst::Context *c) override;
 
+    virtual bool warmUp(Cutelyst::Application *app) override;
+
+    virtual bool hasPublishedPath(const QString &path) override;
+
+    virtual void recordOutput(const QString &output, const QStringList &dependencies) override;
+    virtual bool flushOutputs() override;
+
+    virtual SiteContext *siteContext() override;
+
+    virtual FragmentCache *fragmentCache() override;
+
     virtual QDateTime lastModified() override;
 
+    virtual QTimeZone timeZone() const override;
+
+    /**
+     * Publishes scheduled posts whose time has come and schedules
+     * the job for the next one, returns how many or -1 on error
+     */
+    int publishScheduled(QString *error);
+
+    /**
+     * Invalidates the outputs that offered the resized
+     * copies of an image, once more of them exist
+     */
+    bool invalidateMedia(const QString &hash);
+
+    virtual QVariantList revisions(int pageId) override;
+    virtual bool revision(int pageId, int revision, QString *title, QString *content) override;
+
+    /**
+     * Revisions between full copies, the others are stored
+     * as the change from the one before them
+     */
+    void setRevisionSnapshotInterval(int revisions);
+
+    /**
+     * Bodies at least this long are stored compressed
+     */
+    void setContentCompressThreshold(int characters);
+
     virtual QString addUser(Cutelyst::Context *c, const Cutelyst::ParamsMultiMap &user, bool replace) override;
     virtual bool removeUser(Cutelyst::Context *c, int id) override;
     virtual QVariantList users() override;
     virtual QHash<QString, QString> user(const QString &slug) override;
     virtual QHash<QString, QString> user(int id) override;
 
+    virtual bool backup(const QString &destination, bool compress) override;
+    virtual bool restore(const QString &source) override;
+
+protected:
+    /**
+     * Bound to LIMIT, databases that don't take -1 as no limit
+     * should return a NULL value
+     */
+    virtual QVariant sqlLimit(int limit) const;
+
+    virtual QString autoIncrementKey() const;
+    virtual QString dateTimeType() const;
+    virtual QString blobType() const;
+
+    /**
+     * Version of the schema stored on the database
+     */
+    virtual int schemaVersion();
+    virtual bool setSchemaVersion(int version);
+
+    /**
+     * Creates or migrates the schema holding lockSchema()
+     */
+    bool setupSchema();
+
+    /**
+     * Serializes setupSchema() between all workers
+     */
+    virtual bool lockSchema();
+    virtual void unlockSchema();
+
+    bool createDb();
+
+    /**
+     * Brings an existing database to the current schema version
+     */
+    bool migrateDb();
+
+    /**
+     * Moves bodies over the threshold to the compressed column
+     */
+    bool compressContents();
+
+private Q_SLOTS:
+    void checkpoint();
+
 private:
     virtual int savePageBackend(Page *page) override;
 
+    bool applyPragmas(QSqlDatabase &db, const QHash<QString, QString> &settings, bool readOnly);
+    bool holdsCheckpointLock();
+    void markWrite();
+    bool saveSettingsValue(const QString &key, const QString &value);
+    qint64 touchModified(const QString &key = QStringLiteral("modified"));
+    void scheduleNextPublish();
+    bool saveRevision(int id, const QString &previous, const QString &previousTitle, int previousAuthor,
+                      const QDateTime &previousUpdated, Page *page);
+
+    /**
+     * Starts a new generation and marks every output that
+     * depends on entities, plus \p outputs, as changed on it
+     */
+    qint64 invalidate(const QStringList &entities, const QStringList &outputs = QStringList());
+    qint64 storedGeneration(const QString &key);
+    QStringList recordedOutputs();
+    QStringList postEntities(bool page, int authorId) const;
+    void loadInvalidations(qint64 sinceGeneration);
+
+    /**
+     * Loads the outputs invalidated by content changes and reloads
+     * everything derived from settings, menus and users only if the
+     * settings generation changed, returns the content one or -1
+     */
+    qint64 refreshSettings();
+
     void loadMenus();
     void loadUsers();
-    void configureView(Cutelyst::Context *c);
-    void createDb();
+    void loadPathIndex();
     Page *createPageObj(const QSqlQuery &query, QObject *parent);
 
     QString m_theme;
+    QString m_dbPath;
+    QTimer *m_checkpointTimer = nullptr;
+    QString m_checkpointLockPath;
+    QString m_schemaLockPath;
+    int m_schemaLockFd = -1;
+    QElapsedTimer m_lastWrite;
+    qint64 m_checkpointIdle = 300000;
+    qint64 m_dataVersion = -1;
+    int m_checkpointLockFd = -1;
+    int m_busyTimeout = 5000;
+    bool m_checkpointLeader = false;
+    bool m_truncated = false;
+    int m_revisionInterval = 20;
+    int m_compressThreshold = 512;
     QVariantList m_users;
     QHash<QString, QHash<QString, QString> > m_usersSlug;
     QHash<int, QHash<QString, QString> > m_usersId;
@@ -96,8 +226,17 @@ private:
     QDateTime m_settingsDateTime;
     QTimeZone m_timezone;
     qint64 m_settingsDate = -1;
+    qint64 m_settingsGeneration = -1;
     QList<CMS::Menu *> m_menus;
     QHash<QString, CMS::Menu *> m_menuLocations;
+    QSet<QString> m_publishedPaths;
+    QHash<QString, QStringList> m_pendingOutputs;
+    QHash<QString, uint> m_recordedOutputs;
+    QTimer *m_flushOutputsTimer = nullptr;
+    qint64 m_publishedPathsGeneration = -1;
+    bool m_publishedPathsValid = false;
+    SiteContext *m_siteContext = nullptr;
+    FragmentCache m_fragmentCache;
 };
 
 }
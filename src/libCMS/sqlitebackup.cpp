@@ -0,0 +1,288 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "sqlitebackup.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDebug>
+
+#include <sqlite3.h>
+#include <zlib.h>
+
+using namespace CMS;
+
+#define GZIP_CHUNK 65536
+
+static bool gzipFile(const QString &source, const QString &destination, QString *error)
+{
+    QFile in(source);
+    if (!in.open(QIODevice::ReadOnly)) {
+        *error = in.errorString();
+        return false;
+    }
+
+    gzFile out = gzopen(QFile::encodeName(destination).constData(), "wb");
+    if (!out) {
+        *error = QStringLiteral("Could not open %1 for writing").arg(destination);
+        return false;
+    }
+
+    QByteArray buffer(GZIP_CHUNK, Qt::Uninitialized);
+    qint64 len;
+    while ((len = in.read(buffer.data(), GZIP_CHUNK)) > 0) {
+        if (gzwrite(out, buffer.constData(), unsigned(len)) != len) {
+            int errnum;
+            *error = QString::fromLatin1(gzerror(out, &errnum));
+            gzclose(out);
+            return false;
+        }
+    }
+
+    return gzclose(out) == Z_OK && len == 0;
+}
+
+static bool gunzipFile(const QString &source, const QString &destination, QString *error)
+{
+    gzFile in = gzopen(QFile::encodeName(source).constData(), "rb");
+    if (!in) {
+        *error = QStringLiteral("Could not open %1 for reading").arg(source);
+        return false;
+    }
+
+    QFile out(destination);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *error = out.errorString();
+        gzclose(in);
+        return false;
+    }
+
+    QByteArray buffer(GZIP_CHUNK, Qt::Uninitialized);
+    int len;
+    while ((len = gzread(in, buffer.data(), GZIP_CHUNK)) > 0) {
+        if (out.write(buffer.constData(), len) != len) {
+            *error = out.errorString();
+            gzclose(in);
+            return false;
+        }
+    }
+
+    if (len < 0) {
+        int errnum;
+        *error = QString::fromLatin1(gzerror(in, &errnum));
+    }
+    gzclose(in);
+
+    return len == 0;
+}
+
+SqliteBackup::SqliteBackup()
+{
+
+}
+
+int SqliteBackup::pagesPerStep() const
+{
+    return m_pagesPerStep;
+}
+
+void SqliteBackup::setPagesPerStep(int pages)
+{
+    m_pagesPerStep = pages;
+}
+
+int SqliteBackup::sleepInterval() const
+{
+    return m_sleepInterval;
+}
+
+void SqliteBackup::setSleepInterval(int msecs)
+{
+    m_sleepInterval = msecs;
+}
+
+int SqliteBackup::maxRestarts() const
+{
+    return m_maxRestarts;
+}
+
+void SqliteBackup::setMaxRestarts(int restarts)
+{
+    m_maxRestarts = restarts;
+}
+
+int SqliteBackup::maxUserVersion() const
+{
+    return m_maxUserVersion;
+}
+
+void SqliteBackup::setMaxUserVersion(int version)
+{
+    m_maxUserVersion = version;
+}
+
+QString SqliteBackup::errorString() const
+{
+    return m_errorString;
+}
+
+static bool copyDatabase(sqlite3 *source, sqlite3 *destination, int pagesPerStep, int sleepInterval, int maxRestarts, QString *error)
+{
+    sqlite3_backup *backup = sqlite3_backup_init(destination, "main", source, "main");
+    if (!backup) {
+        *error = QString::fromUtf8(sqlite3_errmsg(destination));
+        return false;
+    }
+
+    int restarts = 0;
+    int lastRemaining = -1;
+    int rc;
+    do {
+        rc = sqlite3_backup_step(backup, restarts > maxRestarts ? -1 : pagesPerStep);
+
+        // Writes from other connections make the backup start over
+        const int remaining = sqlite3_backup_remaining(backup);
+        if (lastRemaining != -1 && remaining > lastRemaining) {
+            ++restarts;
+        }
+        lastRemaining = remaining;
+
+        if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+            sqlite3_sleep(sleepInterval);
+        }
+    } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+    sqlite3_backup_finish(backup);
+
+    if (rc != SQLITE_DONE) {
+        *error = QString::fromUtf8(sqlite3_errstr(rc));
+        return false;
+    }
+    return true;
+}
+
+bool SqliteBackup::backup(const QString &databasePath, const QString &destination, bool compress)
+{
+    m_errorString.clear();
+
+    const QString partial = destination + QLatin1String(".part");
+    QFile::remove(partial);
+
+    sqlite3 *source = nullptr;
+    sqlite3 *target = nullptr;
+    bool ret = false;
+    if (sqlite3_open_v2(QFile::encodeName(databasePath).constData(), &source, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        m_errorString = QString::fromUtf8(sqlite3_errmsg(source));
+    } else if (sqlite3_open_v2(QFile::encodeName(partial).constData(), &target,
+                               SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        m_errorString = QString::fromUtf8(sqlite3_errmsg(target));
+    } else {
+        ret = copyDatabase(source, target, m_pagesPerStep, m_sleepInterval, m_maxRestarts, &m_errorString);
+    }
+    sqlite3_close(target);
+    sqlite3_close(source);
+
+    if (ret) {
+        QFile::remove(destination);
+        if (compress) {
+            ret = gzipFile(partial, destination, &m_errorString);
+        } else {
+            ret = QFile::rename(partial, destination);
+            if (!ret) {
+                m_errorString = QStringLiteral("Could not rename %1 to %2").arg(partial, destination);
+            }
+        }
+    }
+    QFile::remove(partial);
+
+    if (!ret) {
+        qWarning() << "Failed to backup" << databasePath << "to" << destination << m_errorString;
+    }
+    return ret;
+}
+
+bool SqliteBackup::restore(const QString &source, const QString &databasePath)
+{
+    m_errorString.clear();
+
+    QString sourcePath = source;
+    QString uncompressed;
+    if (source.endsWith(QLatin1String(".gz"))) {
+        uncompressed = databasePath + QLatin1String(".restore");
+        if (!gunzipFile(source, uncompressed, &m_errorString)) {
+            QFile::remove(uncompressed);
+            qWarning() << "Failed to uncompress backup" << source << m_errorString;
+            return false;
+        }
+        sourcePath = uncompressed;
+    }
+
+    sqlite3 *backup = nullptr;
+    sqlite3 *target = nullptr;
+    bool ret = false;
+    if (sqlite3_open_v2(QFile::encodeName(sourcePath).constData(), &backup, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+        m_errorString = QString::fromUtf8(sqlite3_errmsg(backup));
+    } else if (sqlite3_open_v2(QFile::encodeName(databasePath).constData(), &target,
+                               SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) != SQLITE_OK) {
+        m_errorString = QString::fromUtf8(sqlite3_errmsg(target));
+    } else if (checkUserVersion(backup)) {
+        sqlite3_busy_timeout(target, 5000);
+        // The backup file is private to us so copy it all at once,
+        // holding the write lock on the live database as little as possible
+        ret = copyDatabase(backup, target, -1, m_sleepInterval, 0, &m_errorString);
+    }
+    sqlite3_close(target);
+    sqlite3_close(backup);
+
+    if (!uncompressed.isEmpty()) {
+        QFile::remove(uncompressed);
+    }
+
+    if (!ret) {
+        qWarning() << "Failed to restore" << source << "into" << databasePath << m_errorString;
+    }
+    return ret;
+}
+
+bool SqliteBackup::checkUserVersion(sqlite3 *db)
+{
+    if (m_maxUserVersion == -1) {
+        return true;
+    }
+
+    sqlite3_stmt *stmt = nullptr;
+    int version = -1;
+    if (sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, nullptr) == SQLITE_OK &&
+            sqlite3_step(stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+
+    if (version == -1) {
+        m_errorString = QString::fromUtf8(sqlite3_errmsg(db));
+        return false;
+    }
+    if (version > m_maxUserVersion) {
+        m_errorString = QStringLiteral("Backup schema version %1 is newer than the supported %2")
+                .arg(version).arg(m_maxUserVersion);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef SQLITEBACKUP_H
+#define SQLITEBACKUP_H
+
+#include <QString>
+
+struct sqlite3;
+
+namespace CMS {
+
+/**
+ * Online backup and restore of a SQLite database using
+ * the sqlite3_backup API, the copy is done a few pages
+ * at a time sleeping in between so writers are not held back
+ */
+class SqliteBackup
+{
+public:
+    SqliteBackup();
+
+    /**
+     * Number of pages copied on each step
+     */
+    int pagesPerStep() const;
+    void setPagesPerStep(int pages);
+
+    /**
+     * Time in milliseconds to sleep between steps
+     */
+    int sleepInterval() const;
+    void setSleepInterval(int msecs);
+
+    /**
+     * When the source is changed by another connection the
+     * backup restarts, after this many restarts the remaining
+     * pages are copied in a single step, which on WAL mode
+     * only holds a read snapshot
+     */
+    int maxRestarts() const;
+    void setMaxRestarts(int restarts);
+
+    /**
+     * Backups whose user_version is above this are not restored,
+     * their schema is newer than the code knows, -1 for any
+     */
+    int maxUserVersion() const;
+    void setMaxUserVersion(int version);
+
+    /**
+     * Backups \p databasePath into \p destination,
+     * when \p compress is true the file is written with gzip
+     */
+    bool backup(const QString &databasePath, const QString &destination, bool compress);
+
+    /**
+     * Restores \p source (optionally gzip compressed) into \p databasePath
+     */
+    bool restore(const QString &source, const QString &databasePath);
+
+    QString errorString() const;
+
+private:
+    bool checkUserVersion(sqlite3 *db);
+
+    int m_pagesPerStep = 128;
+    int m_sleepInterval = 20;
+    int m_maxRestarts = 10;
+    int m_maxUserVersion = -1;
+    QString m_errorString;
+};
+
+}
+
+#endif // SQLITEBACKUP_H
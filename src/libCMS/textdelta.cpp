@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+
+#include "textdelta.h"
+
+#include <QStringList>
+#include <QVector>
+
+using namespace CMS;
+
+TextDelta TextDelta::make(const QString &from, const QString &to)
+{
+    TextDelta ret;
+    const int max = qMin(from.size(), to.size());
+    while (ret.prefix < max && from.at(ret.prefix) == to.at(ret.prefix)) {
+        ++ret.prefix;
+    }
+
+    while (ret.suffix < max - ret.prefix &&
+           from.at(from.size() - ret.suffix - 1) == to.at(to.size() - ret.suffix - 1)) {
+        ++ret.suffix;
+    }
+
+    ret.middle = to.mid(ret.prefix, to.size() - ret.prefix - ret.suffix);
+    return ret;
+}
+
+QString TextDelta::apply(const QString &from) const
+{
+    return from.left(prefix) + middle + from.right(suffix);
+}
+
+QByteArray TextDelta::data() const
+{
+    return qCompress(middle.toUtf8());
+}
+
+TextDelta TextDelta::fromData(int prefix, int suffix, const QByteArray &data)
+{
+    TextDelta ret;
+    ret.prefix = prefix;
+    ret.suffix = suffix;
+    ret.middle = QString::fromUtf8(qUncompress(data));
+    return ret;
+}
+
+static void appendLines(QVariantList &ret, QChar op, const QStringList &lines, int from, int to)
+{
+    for (int i = from; i < to; ++i) {
+        ret.append(QVariantHash{
+                       {QStringLiteral("op"), QString(op)},
+                       {QStringLiteral("text"), lines.at(i)}
+                   });
+    }
+}
+
+QVariantList TextDelta::lineDiff(const QString &from, const QString &to)
+{
+    const QStringList a = from.split(QLatin1Char('\n'));
+    const QStringList b = to.split(QLatin1Char('\n'));
+
+    int start = 0;
+    while (start < a.size() && start < b.size() && a.at(start) == b.at(start)) {
+        ++start;
+    }
+    int endA = a.size();
+    int endB = b.size();
+    while (endA > start && endB > start && a.at(endA - 1) == b.at(endB - 1)) {
+        --endA;
+        --endB;
+    }
+
+    QVariantList ret;
+    appendLines(ret, QLatin1Char(' '), a, 0, start);
+
+    // Longest common subsequence of what changed, too
+    // big a table just shows the old lines then the new
+    const int n = endA - start;
+    const int m = endB - start;
+    if (qint64(n) * m > 4000000) {
+        appendLines(ret, QLatin1Char('-'), a, start, endA);
+        appendLines(ret, QLatin1Char('+'), b, start, endB);
+    } else {
+        QVector<int> lcs((n + 1) * (m + 1), 0);
+        for (int i = n - 1; i >= 0; --i) {
+            for (int j = m - 1; j >= 0; --j) {
+                lcs[i * (m + 1) + j] = a.at(start + i) == b.at(start + j) ?
+                            lcs[(i + 1) * (m + 1) + j + 1] + 1 :
+                            qMax(lcs[(i + 1) * (m + 1) + j], lcs[i * (m + 1) + j + 1]);
+            }
+        }
+
+        int i = 0;
+        int j = 0;
+        while (i < n || j < m) {
+            if (i < n && j < m && a.at(start + i) == b.at(start + j)) {
+                appendLines(ret, QLatin1Char(' '), a, start + i, start + i + 1);
+                ++i;
+                ++j;
+            } else if (j < m && (i == n || lcs[i * (m + 1) + j + 1] >= lcs[(i + 1) * (m + 1) + j])) {
+                appendLines(ret, QLatin1Char('+'), b, start + j, start + j + 1);
+                ++j;
+            } else {
+                appendLines(ret, QLatin1Char('-'), a, start + i, start + i + 1);
+                ++i;
+            }
+        }
+    }
+
+    appendLines(ret, QLatin1Char(' '), a, endA, a.size());
+    return ret;
+}
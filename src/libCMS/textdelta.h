@@ -0,0 +1,61 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+
+#ifndef TEXTDELTA_H
+#define TEXTDELTA_H
+
+#include <QString>
+#include <QByteArray>
+#include <QVariantList>
+
+namespace CMS {
+
+/**
+ * The change between two texts as the length of what they
+ * share at the start and end plus what replaced the middle,
+ * which is what an edit to a post usually looks like
+ */
+class TextDelta
+{
+public:
+    static TextDelta make(const QString &from, const QString &to);
+
+    QString apply(const QString &from) const;
+
+    /**
+     * The middle compressed, as stored
+     */
+    QByteArray data() const;
+    static TextDelta fromData(int prefix, int suffix, const QByteArray &data);
+
+    /**
+     * Lines removed, added and kept to get from one text to the
+     * other, as maps with "op" ('-', '+' or ' ') and "text"
+     */
+    static QVariantList lineDiff(const QString &from, const QString &to);
+
+    int prefix = 0;
+    int suffix = 0;
+    QString middle;
+};
+
+}
+
+#endif // TEXTDELTA_H
@@ -0,0 +1,218 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "outputcacheplugin.h"
+
+#include <Cutelyst/Application>
+#include <Cutelyst/Context>
+#include <Cutelyst/Request>
+#include <Cutelyst/Response>
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+#include "libCMS/engine.h"
+#include "libCMS/outputcache.h"
+#include "libCMS/sharedoutputcache.h"
+
+#define CACHE_KEY_PROPERTY "_output_cache_key"
+#define CACHE_GENERATION_PROPERTY "_output_cache_generation"
+
+OutputCachePlugin::OutputCachePlugin(Application *parent) : Plugin(parent)
+  , m_cache(CMS::OutputCache::instance())
+{
+}
+
+bool OutputCachePlugin::setup(Application *app)
+{
+    m_app = app;
+
+    // With the shared cache the local one is only used to coalesce misses
+    const bool shared = app->config(QStringLiteral("OutputCacheShared"), false).toBool();
+    m_cache->setMaxSize(app->config(QStringLiteral("OutputCacheSize"), shared ? 0 : 32 * 1024 * 1024).toInt());
+    m_cache->setWaitTimeout(app->config(QStringLiteral("OutputCacheWaitTimeout"), 5000).toInt());
+    m_cache->setServeStale(app->config(QStringLiteral("OutputCacheServeStale"), true).toBool());
+    m_keyHeader = app->config(QStringLiteral("SurrogateKeyHeader"), QStringLiteral("Surrogate-Key")).toString();
+
+    connect(app, &Application::beforePrepareAction, this, &OutputCachePlugin::beforePrepareAction);
+    connect(app, &Application::afterDispatch, this, &OutputCachePlugin::afterDispatch);
+    return true;
+}
+
+void OutputCachePlugin::setEngine(CMS::Engine *engine)
+{
+    m_engine = engine;
+    connect(engine, &CMS::Engine::outputsInvalidated, this, [=] (const QStringList &outputs) {
+        m_cache->invalidate(outputs);
+    });
+
+    if (!m_app->config(QStringLiteral("OutputCacheShared"), false).toBool()) {
+        return;
+    }
+
+    // Opened after forking, flock() locks would be shared otherwise
+    QString path = m_app->config(QStringLiteral("OutputCacheSharedPath")).toString();
+    if (path.isEmpty()) {
+        // Outputs are only valid for the database they came from, so the
+        // default is per site and on a location emptied on every boot
+        QString runtimeDir = QFile::decodeName(qgetenv("XDG_RUNTIME_DIR"));
+        if (runtimeDir.isEmpty() || !QDir(runtimeDir).exists()) {
+            runtimeDir = QStringLiteral("/dev/shm");
+        }
+        const QByteArray site = QCryptographicHash::hash(QFile::encodeName(m_app->config(QStringLiteral("DataLocation")).toString()),
+                                                         QCryptographicHash::Sha1).toHex().left(16);
+        path = runtimeDir + QLatin1String("/cmlyst-output-cache-") + QString::fromLatin1(site);
+    }
+    CMS::SharedOutputCache *shared = CMS::SharedOutputCache::instance();
+    if (!shared->open(path,
+                      m_app->config(QStringLiteral("OutputCacheSharedSlots"), 512).toInt(),
+                      m_app->config(QStringLiteral("OutputCacheSharedSlotSize"), 131072).toInt())) {
+        return;
+    }
+    m_shared = shared;
+
+    // Only the process making a change updates the shared cache, others
+    // reading it see the new generation and invalidated entries right away
+    connect(engine, &CMS::Engine::generationStarted, this, [=] (qint64 generation) {
+        m_changeGeneration = generation;
+        m_shared->startGeneration(generation);
+    });
+    connect(engine, &CMS::Engine::contentChanged, this, [=] (const QStringList &entities, const QStringList &outputs) {
+        Q_UNUSED(entities)
+        m_shared->invalidate(outputs, m_changeGeneration);
+    });
+}
+
+void OutputCachePlugin::beforePrepareAction(Context *c, bool *skipMethod)
+{
+    Request *req = c->req();
+    if (!m_engine || (req->method() != QLatin1String("GET") && req->method() != QLatin1String("HEAD")) ||
+            req->path().startsWith(QLatin1String(".admin")) || req->path().startsWith(QLatin1String(".media")) ||
+            req->path().startsWith(QLatin1String(".asset"))) {
+        return;
+    }
+
+    // Picks up invalidations made by other processes
+    m_engine->loadSettings(c);
+
+    // Same name Root records the output under, if it paginates
+    QString key = QLatin1Char('/') + req->path();
+    const int page = req->queryParam(QStringLiteral("page")).toInt();
+    if (page > 1) {
+        key.append(QLatin1String("?page=") + QString::number(page));
+    }
+
+    CMS::OutputCache::Entry entry;
+    const CMS::OutputCache::Result result = m_cache->lookup(key, &entry);
+    if (result == CMS::OutputCache::Hit) {
+        serve(c, entry, QStringLiteral("HIT"));
+        *skipMethod = true;
+    } else if (result == CMS::OutputCache::Stale) {
+        serve(c, entry, QStringLiteral("STALE"));
+        *skipMethod = true;
+    } else if (result == CMS::OutputCache::Render) {
+        if (m_shared && m_shared->value(key, &entry)) {
+            m_cache->insert(key, entry);
+            serve(c, entry, QStringLiteral("HIT-SHARED"));
+            *skipMethod = true;
+            return;
+        }
+
+        // HEAD responses have no body, only a GET can fill the entry
+        if (req->method() != QLatin1String("GET")) {
+            m_cache->abandon(key);
+            return;
+        }
+
+        c->setProperty(CACHE_KEY_PROPERTY, key);
+        c->setProperty(CACHE_GENERATION_PROPERTY, m_engine->lastModified().toMSecsSinceEpoch() / 1000);
+    }
+}
+
+void OutputCachePlugin::serve(Context *c, const CMS::OutputCache::Entry &entry, const QString &status)
+{
+    Response *res = c->res();
+    Headers &headers = res->headers();
+    auto it = entry.headers.constBegin();
+    while (it != entry.headers.constEnd()) {
+        headers.setHeader(it.key(), it.value());
+        ++it;
+    }
+    headers.setHeader(QStringLiteral("X-Cache"), status);
+
+    // Clients send back the exact Last-Modified they got
+    const QString lastModified = entry.headers.value(QStringLiteral("Last-Modified"));
+    if (!lastModified.isEmpty() && c->req()->headers().header(QStringLiteral("If-Modified-Since")) == lastModified) {
+        res->setStatus(Response::NotModified);
+    } else {
+        res->setBody(entry.body);
+    }
+}
+
+void OutputCachePlugin::afterDispatch(Context *c)
+{
+    const QString key = c->property(CACHE_KEY_PROPERTY).toString();
+    if (key.isEmpty()) {
+        return;
+    }
+
+    // Pages ignoring the query are not stored for every ?page= asked
+    Response *res = c->res();
+    if (res->status() != Response::OK || c->property("_cms_output").toString() != key) {
+        m_cache->abandon(key);
+        return;
+    }
+
+    CMS::OutputCache::Entry entry;
+    auto buffer = qobject_cast<QBuffer *>(res->bodyDevice());
+    if (buffer) {
+        entry.body = buffer->data();
+    } else if (!res->bodyDevice()) {
+        entry.body = res->body();
+    } else {
+        m_cache->abandon(key);
+        return;
+    }
+
+    const Headers &headers = res->headers();
+    const QStringList names = {
+        QStringLiteral("Content-Type"),
+        QStringLiteral("Last-Modified"),
+        QStringLiteral("Cache-Control"),
+        m_keyHeader
+    };
+    for (const QString &name : names) {
+        const QString value = headers.header(name);
+        if (!name.isEmpty() && !value.isEmpty()) {
+            entry.headers.insert(name, value);
+        }
+    }
+
+    // Dependencies must be stored before others can read the
+    // entry, or a change made meanwhile would not invalidate it
+    if (m_shared && m_engine->flushOutputs()) {
+        m_shared->insert(key, c->property(CACHE_GENERATION_PROPERTY).toLongLong(), entry);
+    }
+
+    m_cache->insert(key, entry);
+    res->headers().setHeader(QStringLiteral("X-Cache"), QStringLiteral("MISS"));
+}
@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef OUTPUTCACHEPLUGIN_H
+#define OUTPUTCACHEPLUGIN_H
+
+#include <Cutelyst/Plugin>
+
+#include "libCMS/outputcache.h"
+
+namespace CMS {
+class Engine;
+class SharedOutputCache;
+}
+
+using namespace Cutelyst;
+
+/**
+ * Serves published outputs from the process wide
+ * OutputCache, or the SharedOutputCache of all
+ * processes when enabled, before anything is
+ * dispatched, and stores what was rendered when it missed
+ */
+class OutputCachePlugin : public Plugin
+{
+    Q_OBJECT
+public:
+    explicit OutputCachePlugin(Application *parent);
+
+    virtual bool setup(Application *app) override;
+
+    /**
+     * Outputs invalidated by engine are marked stale,
+     * must be called after forking
+     */
+    void setEngine(CMS::Engine *engine);
+
+private:
+    void beforePrepareAction(Context *c, bool *skipMethod);
+    void afterDispatch(Context *c);
+    void serve(Context *c, const CMS::OutputCache::Entry &entry, const QString &status);
+
+    Application *m_app = nullptr;
+    CMS::Engine *m_engine = nullptr;
+    CMS::OutputCache *m_cache;
+    CMS::SharedOutputCache *m_shared = nullptr;
+    qint64 m_changeGeneration = 0;
+    QString m_keyHeader;
+};
+
+#endif // OUTPUTCACHEPLUGIN_H
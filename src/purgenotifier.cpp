@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "purgenotifier.h"
+
+#include "libCMS/engine.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QTimer>
+#include <QDebug>
+
+PurgeNotifier::PurgeNotifier(CMS::Engine *engine, const QUrl &url, QObject *parent) : QObject(parent)
+  , m_nam(new QNetworkAccessManager(this))
+  , m_url(url)
+{
+    connect(engine, &CMS::Engine::contentChanged, this, &PurgeNotifier::contentChanged);
+}
+
+void PurgeNotifier::setMethod(const QByteArray &method)
+{
+    m_method = method;
+}
+
+void PurgeNotifier::setKeyHeader(const QByteArray &header)
+{
+    m_keyHeader = header;
+}
+
+void PurgeNotifier::setMaxAttempts(int attempts)
+{
+    m_maxAttempts = qMax(1, attempts);
+}
+
+void PurgeNotifier::contentChanged(const QStringList &entities, const QStringList &outputs)
+{
+    if (entities.isEmpty() && outputs.isEmpty()) {
+        return;
+    }
+
+    const QByteArray keys = entities.join(QLatin1Char(' ')).toUtf8();
+    const QByteArray body = QJsonDocument(QJsonObject{
+                                              {QStringLiteral("keys"), QJsonArray::fromStringList(entities)},
+                                              {QStringLiteral("urls"), QJsonArray::fromStringList(outputs)}
+                                          }).toJson(QJsonDocument::Compact);
+    send(keys, body, 1);
+}
+
+void PurgeNotifier::send(const QByteArray &keys, const QByteArray &body, int attempt)
+{
+    QNetworkRequest request(m_url);
+    request.setRawHeader(m_keyHeader, keys);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, QByteArrayLiteral("application/json"));
+
+    QNetworkReply *reply = m_nam->sendCustomRequest(request, m_method, body);
+    connect(reply, &QNetworkReply::finished, this, [=] {
+        reply->deleteLater();
+
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (reply->error() == QNetworkReply::NoError && status >= 200 && status < 300) {
+            return;
+        }
+
+        if (attempt < m_maxAttempts) {
+            // Back off a bit more on each attempt
+            QTimer::singleShot(1000 * attempt, this, [=] {
+                send(keys, body, attempt + 1);
+            });
+        } else {
+            qWarning() << "Failed to purge" << keys << "from" << m_url << status << reply->errorString();
+        }
+    });
+}
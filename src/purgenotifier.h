@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef PURGENOTIFIER_H
+#define PURGENOTIFIER_H
+
+#include <QObject>
+#include <QUrl>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+namespace CMS {
+class Engine;
+}
+
+/**
+ * Sends a purge request to a caching proxy whenever the engine
+ * changes content, carrying the changed entities as surrogate
+ * keys and the affected URLs on a JSON body
+ */
+class PurgeNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PurgeNotifier(CMS::Engine *engine, const QUrl &url, QObject *parent = 0);
+
+    /**
+     * HTTP method used, defaults to PURGE
+     */
+    void setMethod(const QByteArray &method);
+
+    /**
+     * Header that carries the keys, defaults to Surrogate-Key
+     */
+    void setKeyHeader(const QByteArray &header);
+
+    void setMaxAttempts(int attempts);
+
+private:
+    void contentChanged(const QStringList &entities, const QStringList &outputs);
+    void send(const QByteArray &keys, const QByteArray &body, int attempt);
+
+    QNetworkAccessManager *m_nam;
+    QUrl m_url;
+    QByteArray m_method = QByteArrayLiteral("PURGE");
+    QByteArray m_keyHeader = QByteArrayLiteral("Surrogate-Key");
+    int m_maxAttempts = 3;
+};
+
+#endif // PURGENOTIFIER_H
@@ -26,17 +26,83 @@
 #include <Cutelyst/Plugins/Utils/Sql>
 #include <Cutelyst/Plugins/Utils/Pagination>
 
-#include <grantlee/safestring.h>
-
 #include <QSqlQuery>
 
 #include <QBuffer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QHostAddress>
+#include <QRegularExpression>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
 #include <QDebug>
 
 #include "libCMS/page.h"
 #include "libCMS/menu.h"
+#include "libCMS/sitecontext.h"
+#include "libCMS/outputcache.h"
+#include "libCMS/sharedoutputcache.h"
+#include "libCMS/mediastore.h"
+#include "libCMS/imagederivatives.h"
+#include "libCMS/contentcodec.h"
 
 #include "rsswriter.h"
+#include "cachepolicy.h"
+#include "assetindex.h"
+#include "fileserver.h"
+#include "cachetag.h"
+
+// Settings read by every themed output
+static const QStringList themeDependencies = {
+    QStringLiteral("setting:theme"),
+    QStringLiteral("setting:title"),
+    QStringLiteral("setting:tagline"),
+    QStringLiteral("setting:cms_head"),
+    QStringLiteral("setting:cms_foot"),
+    QStringLiteral("setting:menus"),
+    QStringLiteral("setting:timezone"),
+};
+
+// Settings that decide what is shown on the front page
+static const QStringList frontDependencies = {
+    QStringLiteral("setting:show_on_front"),
+    QStringLiteral("setting:page_on_front"),
+    QStringLiteral("setting:page_for_posts"),
+};
+
+static QString outputName(Context *c)
+{
+    QString output = QLatin1Char('/') + c->req()->path();
+    const int page = c->property("_cms_page").toInt();
+    if (page > 1) {
+        output.append(QLatin1String("?page=") + QString::number(page));
+    }
+    return output;
+}
+
+// Returns the listing page asked for, or 0 past the last one, only
+// those that exist are rendered and recorded under their own name
+static int listingPage(Context *c, int rows, int postsPerPage)
+{
+    const int page = qMax(1, c->req()->queryParam(QStringLiteral("page")).toInt());
+    const int pages = qMax(1, (rows + postsPerPage - 1) / qMax(1, postsPerPage));
+    if (page > pages) {
+        return 0;
+    }
+    c->setProperty("_cms_page", page);
+    return page;
+}
+
+static void addPostsDependencies(Context *c, const QList<CMS::Page *> &posts)
+{
+    QStringList deps;
+    for (CMS::Page *post : posts) {
+        deps.append(QLatin1String("post:") + QString::number(post->id()));
+    }
+    CMS::Engine::addDependencies(c, deps);
+}
 
 Root::Root(QObject *app) : Controller(app)
 {
@@ -57,10 +123,38 @@ void Root::notFound(Context *c)
 
 bool Root::End(Context *c)
 {
-    const QString theme = engine->settingsValue(QStringLiteral("theme"), QStringLiteral("default"));
+    c->setStash(QStringLiteral("basetheme"), engine->siteContext()->baseTheme(c));
 
-    const QString staticTheme = QLatin1String("/static/themes/") + theme;
-    c->setStash(QStringLiteral("basetheme"), c->uriFor(staticTheme).toString());
+    CachePolicy::apply(c);
+
+    if (c->res()->status() == Response::OK) {
+        // Rendered here instead of after by RenderView so the
+        // images the template passed to srcset are known
+        SrcsetFilter::takeDependencies();
+        if (!c->res()->hasBody() && c->req()->method() != QLatin1String("HEAD") && !c->forward(c->view())) {
+            return false;
+        }
+        CMS::Engine::addDependencies(c, SrcsetFilter::takeDependencies());
+
+        const QStringList deps = CMS::Engine::dependencies(c);
+        if (!deps.isEmpty()) {
+            // The output cache only stores what was recorded
+            const QString output = outputName(c);
+            c->setProperty("_cms_output", output);
+            engine->recordOutput(output, deps);
+        }
+
+        // Lets a caching proxy purge exactly the outputs that depend on
+        // what changed, "cmlyst" purges everything and the generation
+        // one everything rendered before a given change
+        const QString header = c->config(QStringLiteral("SurrogateKeyHeader"), QStringLiteral("Surrogate-Key")).toString();
+        if (!header.isEmpty()) {
+            QStringList keys = deps;
+            keys.append(QStringLiteral("cmlyst"));
+            keys.append(QLatin1String("gen:") + QString::number(engine->lastModified().toMSecsSinceEpoch() / 1000));
+            c->res()->headers().setHeader(header, keys.join(QLatin1Char(' ')));
+        }
+    }
 
     return true;
 }
@@ -72,6 +166,7 @@ void Root::page(Cutelyst::Context *c)
 
     // Get the desired page (dispatcher already found it)
     auto page = c->stash(QStringLiteral("page")).value<CMS::Page *>();
+    CachePolicy::setRoute(c, CachePolicy::Page);
 //    QVariantHash page = c->stash(QStringLiteral("page")).toHash();
 
     // See if the page has changed, if the settings have changed
@@ -88,18 +183,7 @@ void Root::page(Cutelyst::Context *c)
     QString cmsPagePath = QLatin1Char('/') + c->req()->path();
     engine->setProperty("pagePath", cmsPagePath);
 
-    auto settings = engine->settings();
-    const QString cms_head = settings.value(QStringLiteral("cms_head"));
-    if (!cms_head.isEmpty()) {
-        const Grantlee::SafeString safe(cms_head, true);
-        c->setStash(QStringLiteral("cms_head"), QVariant::fromValue(safe));
-    }
-
-    const QString cms_foot = settings.value(QStringLiteral("cms_head"));
-    if (!cms_foot.isEmpty()) {
-        const Grantlee::SafeString safe(cms_foot, true);
-        c->setStash(QStringLiteral("cms_foot"), QVariant::fromValue(safe));
-    }
+    c->stash(engine->siteContext()->stash());
 
     if (page->page())  {
         c->setStash(QStringLiteral("template"), QStringLiteral("page.html"));
@@ -107,11 +191,20 @@ void Root::page(Cutelyst::Context *c)
         c->setStash(QStringLiteral("template"), QStringLiteral("blog.html"));
     }
     c->setStash(QStringLiteral("meta_title"), page->title());
+    c->setStash(QStringLiteral("cmsPagePath"), cmsPagePath);
     c->setStash(QStringLiteral("cms"), QVariant::fromValue(engine));
+
+    CMS::Engine::addDependencies(c, themeDependencies);
+    CMS::Engine::addDependency(c, QLatin1String("post:") + QString::number(page->id()));
+    if (c->req()->path().isEmpty()) {
+        CMS::Engine::addDependencies(c, frontDependencies);
+    }
 }
 
 void Root::lastPosts(Context *c)
 {
+    CachePolicy::setRoute(c, CachePolicy::Listing);
+
     Response *res = c->res();
     Request *req = c->req();
 
@@ -127,18 +220,24 @@ void Root::lastPosts(Context *c)
     }
     res->headers().setLastModified(currentDateTime);
 
-    const auto settings = engine->settings();
-    const int postsPerPage = settings.value(QStringLiteral("posts_per_page"), QStringLiteral("10")).toInt();
+    CMS::SiteContext *site = engine->siteContext();
+    const int postsPerPage = site->postsPerPage();
     int offset;
 
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT count(*) FROM posts WHERE page = 0 AND published = 1"),
-                QStringLiteral("cmlyst"));
+                QStringLiteral("SELECT count(*) FROM posts WHERE NOT page AND published"),
+                QStringLiteral("cmlyst_ro"));
     if (Q_LIKELY(query.exec() && query.next())) {
         int rows = query.value(0).toInt();
+        query.finish();
+        const int page = listingPage(c, rows, postsPerPage);
+        if (!page) {
+            notFound(c);
+            return;
+        }
         Pagination pagination(rows,
                               postsPerPage,
-                              c->req()->queryParam(QStringLiteral("page"), QStringLiteral("1")).toInt());
+                              page);
         offset = pagination.offset();
         c->setStash(QStringLiteral("pagination"), pagination);
     } else {
@@ -148,12 +247,20 @@ void Root::lastPosts(Context *c)
 
     const QList<CMS::Page *> posts = engine->listPostsPublished(c, offset, postsPerPage);
 
+    CMS::Engine::addDependencies(c, themeDependencies);
+    CMS::Engine::addDependencies(c, frontDependencies);
+    CMS::Engine::addDependencies(c, {
+                                     QStringLiteral("posts"),
+                                     QStringLiteral("setting:posts_per_page")
+                                 });
+    addPostsDependencies(c, posts);
+
     QString cmsPagePath = QLatin1Char('/') + c->req()->path();
     engine->setProperty("pagePath", cmsPagePath);
+    c->stash(site->stash());
     c->stash({
                  {QStringLiteral("template"), QStringLiteral("posts.html")},
-                 {QStringLiteral("meta_title"), settings.value(QStringLiteral("title"))},
-                 {QStringLiteral("meta_description"), settings.value(QStringLiteral("tagline"))},
+                 {QStringLiteral("cmsPagePath"), cmsPagePath},
                  {QStringLiteral("cms"), QVariant::fromValue(engine)},
                  {QStringLiteral("posts"), QVariant::fromValue(posts)}
              });
@@ -161,6 +268,8 @@ void Root::lastPosts(Context *c)
 
 void Root::feed(Context *c)
 {
+    CachePolicy::setRoute(c, CachePolicy::Feed);
+
     Request *req = c->req();
     Response *res = c->res();
 
@@ -178,17 +287,23 @@ void Root::feed(Context *c)
     headers.setContentType(QStringLiteral("text/xml; charset=UTF-8"));
 
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT p.title, p.path, u.slug, p.published_at, p.content "
+                QStringLiteral("SELECT p.title, p.path, u.slug, p.published_at, p.html,"
+                               " CASE WHEN p.html IS NULL THEN p.content END, CASE WHEN p.html IS NULL THEN p.content_z END "
                                "FROM posts p "
                                "LEFT JOIN users u ON u.id = p.author_id "
-                               "WHERE page = 0 AND published = 1 "
+                               "WHERE NOT page AND published "
                                "ORDER BY published_at DESC "
                                "LIMIT :limit "
                                ),
-                QStringLiteral("cmlyst"));
+                QStringLiteral("cmlyst_ro"));
     query.bindValue(QStringLiteral(":limit"), 10);
 
-    auto settings = engine->settings();
+    CMS::SiteContext *site = engine->siteContext();
+    CMS::Engine::addDependencies(c, {
+                                     QStringLiteral("posts"),
+                                     QStringLiteral("setting:title"),
+                                     QStringLiteral("setting:tagline")
+                                 });
 
     auto buffer = new QBuffer(c);
     buffer->open(QIODevice::ReadWrite);
@@ -198,10 +313,10 @@ void Root::feed(Context *c)
 
     writer.startRSS();
     writer.writeStartChannel();
-    writer.writeChannelTitle(settings.value(QStringLiteral("title")));
+    writer.writeChannelTitle(site->title());
     writer.writeChannelFeedLink(c->uriFor(c->action()).toString());
     writer.writeChannelLink(req->base());
-    writer.writeChannelDescription(settings.value(QStringLiteral("tagline")));
+    writer.writeChannelDescription(site->tagline());
 
     if (Q_LIKELY(query.exec())) {
         writer.writeChannelLastBuildDate(currentDateTime);
@@ -216,11 +331,9 @@ void Root::feed(Context *c)
             writer.writeItemCommentsLink(link + QLatin1String("#comments"));
             writer.writeItemCreator(query.value(2).toString());
 
-            QDateTime published = QDateTime::fromString(query.value(3).toString(), QStringLiteral("yyyy-MM-dd HH:mm:ss"));
-            published.setTimeSpec(Qt::UTC);
-            writer.writeItemPubDate(published);
+            writer.writeItemPubDate(CMS::Engine::fromSqlDateTime(query.value(3)));
 
-            const QString content = query.value(4).toString();
+            const QString content = query.value(4).isNull() ? CMS::ContentCodec::content(query.value(5), query.value(6)) : query.value(4).toString();
             writer.writeItemDescription(content.left(300));
             writer.writeItemContent(content);
 
@@ -234,6 +347,8 @@ void Root::feed(Context *c)
 
 void Root::author(Context *c, const QString &slug)
 {
+    CachePolicy::setRoute(c, CachePolicy::Author);
+
     Response *res = c->res();
     Request *req = c->req();
 
@@ -252,19 +367,25 @@ void Root::author(Context *c, const QString &slug)
     }
     int authorId = authorData.value(QStringLiteral("id")).toInt();
 
-    const auto settings = engine->settings();
-    const int postsPerPage = settings.value(QStringLiteral("posts_per_page"), QStringLiteral("10")).toInt();
+    CMS::SiteContext *site = engine->siteContext();
+    const int postsPerPage = site->postsPerPage();
     int offset;
 
     QSqlQuery query = CPreparedSqlQueryThreadForDB(
-                QStringLiteral("SELECT count(*) FROM posts WHERE page = 0 AND published = 1 AND author_id = :author_id"),
-                QStringLiteral("cmlyst"));
+                QStringLiteral("SELECT count(*) FROM posts WHERE NOT page AND published AND author_id = :author_id"),
+                QStringLiteral("cmlyst_ro"));
     query.bindValue(QStringLiteral(":author_id"), authorId);
     if (Q_LIKELY(query.exec() && query.next())) {
         int rows = query.value(0).toInt();
+        query.finish();
+        const int page = listingPage(c, rows, postsPerPage);
+        if (!page) {
+            notFound(c);
+            return;
+        }
         Pagination pagination(rows,
                               postsPerPage,
-                              c->req()->queryParam(QStringLiteral("page"), QStringLiteral("1")).toInt());
+                              page);
         offset = pagination.offset();
         c->setStash(QStringLiteral("pagination"), pagination);
         c->setStash(QStringLiteral("posts_count"), rows);
@@ -279,24 +400,241 @@ void Root::author(Context *c, const QString &slug)
                                              offset,
                                              postsPerPage);
 
-    const QString cms_head = settings.value(QStringLiteral("cms_head"));
-    if (!cms_head.isEmpty()) {
-        const Grantlee::SafeString safe(cms_head, true);
-        c->setStash(QStringLiteral("cms_head"), QVariant::fromValue(safe));
-    }
-
-    const QString cms_foot = settings.value(QStringLiteral("cms_head"));
-    if (!cms_foot.isEmpty()) {
-        const Grantlee::SafeString safe(cms_foot, true);
-        c->setStash(QStringLiteral("cms_foot"), QVariant::fromValue(safe));
-    }
+    CMS::Engine::addDependencies(c, themeDependencies);
+    CMS::Engine::addDependencies(c, {
+                                     QLatin1String("author:") + QString::number(authorId),
+                                     QLatin1String("author-posts:") + QString::number(authorId),
+                                     QStringLiteral("setting:posts_per_page")
+                                 });
+    addPostsDependencies(c, posts);
 
+    c->stash(site->stash());
     c->stash({
                  {QStringLiteral("template"), QStringLiteral("author.html")},
-                 {QStringLiteral("meta_title"), settings.value(QStringLiteral("title"))},
-                 {QStringLiteral("meta_description"), settings.value(QStringLiteral("tagline"))},
                  {QStringLiteral("cms"), QVariant::fromValue(engine)},
                  {QStringLiteral("author"), QVariant::fromValue(authorData)},
                  {QStringLiteral("posts"), QVariant::fromValue(posts)}
              });
 }
+
+void Root::asset(Context *c, const QStringList &path)
+{
+    if (path.size() < 2) {
+        notFound(c);
+        return;
+    }
+
+    const QString relative = path.mid(1).join(QLatin1Char('/'));
+    const QString fingerprint = AssetIndex::fingerprint(relative);
+    if (fingerprint.isEmpty()) {
+        notFound(c);
+        return;
+    }
+
+    // Old fingerprints, or relative URLs inside assets, go to the current one
+    if (fingerprint != path.first()) {
+        c->res()->redirect(AssetIndex::url(relative));
+        return;
+    }
+
+    static QMimeDatabase db;
+    const QString file = AssetIndex::filePath(relative);
+    if (!FileServer::serve(c, file, QLatin1Char('"') + fingerprint + QLatin1Char('"'),
+                           db.mimeTypeForFile(file, QMimeDatabase::MatchExtension).name())) {
+        notFound(c);
+        return;
+    }
+    CachePolicy::setRoute(c, CachePolicy::Asset);
+}
+
+void Root::media(Context *c, const QStringList &path)
+{
+    static CMS::MediaStore store(c->config(QStringLiteral("DataLocation")).toString() + QLatin1String("/media"));
+
+    if (path.isEmpty()) {
+        notFound(c);
+        return;
+    }
+
+    // Names from before content addressing go to their hash URL
+    const bool derivative = path.size() == 3 && path.at(1).startsWith(QLatin1Char('w'));
+    if ((path.size() != 2 && !derivative) || !CMS::MediaStore::isHash(path.first())) {
+        const QString name = path.join(QLatin1Char('/'));
+        const QString hash = store.hash(name);
+        if (hash.isEmpty()) {
+            notFound(c);
+        } else {
+            c->res()->redirect(CMS::MediaStore::url(hash, name), Response::MovedPermanently);
+        }
+        return;
+    }
+
+    QString file = store.blobPath(path.first());
+    QString etag = path.first();
+    if (derivative) {
+        const QString format = QFileInfo(path.last()).suffix().toLower();
+        const int width = path.at(1).mid(1).toInt();
+        static const QRegularExpression formatRe(QStringLiteral("^[a-z0-9]+$"));
+        if (width <= 0 || !formatRe.match(format).hasMatch()) {
+            notFound(c);
+            return;
+        }
+
+        file = CMS::ImageDerivatives::instance()->path(path.first(), width, format);
+        etag += QLatin1Char('-') + path.at(1) + QLatin1Char('.') + format;
+
+        // Not generated yet, or not a size that is generated, the
+        // original is served under the extension it was uploaded with
+        if (!QFile::exists(file)) {
+            const QString suffix = QFileInfo(store.name(path.first())).suffix();
+            if (suffix.isEmpty()) {
+                notFound(c);
+                return;
+            }
+            c->res()->redirect(CMS::MediaStore::url(path.first(),
+                                                    QFileInfo(path.last()).completeBaseName() + QLatin1Char('.') + suffix));
+            return;
+        }
+    }
+
+    static QMimeDatabase db;
+    if (!FileServer::serve(c, file, QLatin1Char('"') + etag + QLatin1Char('"'),
+                           db.mimeTypeForFile(path.last(), QMimeDatabase::MatchExtension).name(),
+                           file.mid(store.root().size() + 1))) {
+        notFound(c);
+        return;
+    }
+    CachePolicy::setRoute(c, CachePolicy::Media);
+}
+
+void Root::ready(Context *c)
+{
+    Response *res = c->res();
+    res->headers().setHeader(QStringLiteral("Cache-Control"), QStringLiteral("no-cache"));
+    res->setContentType(QStringLiteral("text/plain"));
+    if (engine->isReady()) {
+        QByteArray body = QByteArrayLiteral("ready\n");
+        const QList<QPair<QString, QVariantHash> > caches = {
+            { QStringLiteral("output_cache_"), CMS::OutputCache::instance()->stats() },
+            { QStringLiteral("shared_output_cache_"), CMS::SharedOutputCache::instance()->stats() },
+        };
+        for (const auto &cache : caches) {
+            auto it = cache.second.constBegin();
+            while (it != cache.second.constEnd()) {
+                body.append((cache.first + it.key() + QLatin1Char(' ') + it.value().toString() + QLatin1Char('\n')).toUtf8());
+                ++it;
+            }
+        }
+        res->setBody(body);
+    } else {
+        res->setStatus(Response::ServiceUnavailable);
+        res->setBody(QByteArrayLiteral("warming up\n"));
+    }
+}
+
+void Root::manifest(Context *c)
+{
+    // Scans every post and output, so it's only for the static exporter
+    const QString token = c->config(QStringLiteral("ManifestToken")).toString();
+    const bool allowed = token.isEmpty() ?
+                c->req()->address().isLoopback() :
+                c->req()->headers().header(QStringLiteral("X-Manifest-Token")) == token;
+    if (!allowed) {
+        notFound(c);
+        return;
+    }
+
+    engine->loadSettings(c);
+
+    // An output changes on the generation it was last invalidated, those
+    // without recorded dependencies are assumed to change on every one
+    const qint64 generation = engine->lastModified().toMSecsSinceEpoch() / 1000;
+    const int postsPerPage = qMax(1, engine->siteContext()->postsPerPage());
+
+    QHash<QString, qint64> versions;
+    QSqlQuery query = CPreparedSqlQueryThreadForDB(
+                QStringLiteral("SELECT d.output, v.generation FROM "
+                               "(SELECT DISTINCT output FROM output_deps) d "
+                               "LEFT JOIN output_versions v ON v.output = d.output"),
+                QStringLiteral("cmlyst_ro"));
+    if (Q_LIKELY(query.exec())) {
+        while (query.next()) {
+            versions.insert(query.value(0).toString(), query.value(1).toLongLong());
+        }
+    }
+
+    QJsonArray outputs;
+    auto addOutput = [&] (const QString &url) {
+        outputs.append(QJsonObject{
+                           {QStringLiteral("url"), url},
+                           {QStringLiteral("modified"), double(versions.value(url, generation))}
+                       });
+    };
+    auto addListing = [&] (const QString &url, int rows) {
+        addOutput(url);
+        const int pages = (rows + postsPerPage - 1) / postsPerPage;
+        for (int i = 2; i <= pages; ++i) {
+            addOutput(url + QLatin1String("?page=") + QString::number(i));
+        }
+    };
+
+    const bool showPostsOnFront = engine->settingsValue(QStringLiteral("show_on_front"), QStringLiteral("posts")) == QLatin1String("posts");
+    const QString pageOnFront = engine->settingsValue(QStringLiteral("page_on_front"));
+    const QString pageForPosts = engine->settingsValue(QStringLiteral("page_for_posts"));
+
+    query = CPreparedSqlQueryThreadForDB(
+                QStringLiteral("SELECT count(*) FROM posts WHERE NOT page AND published"),
+                QStringLiteral("cmlyst_ro"));
+    if (Q_LIKELY(query.exec() && query.next())) {
+        const int rows = query.value(0).toInt();
+        query.finish();
+        if (showPostsOnFront) {
+            addListing(QStringLiteral("/"), rows);
+        } else if (!pageForPosts.isEmpty()) {
+            addListing(QLatin1Char('/') + pageForPosts, rows);
+        }
+    }
+
+    query = CPreparedSqlQueryThreadForDB(
+                QStringLiteral("SELECT path FROM posts WHERE published"),
+                QStringLiteral("cmlyst_ro"));
+    if (Q_LIKELY(query.exec())) {
+        while (query.next()) {
+            const QString path = query.value(0).toString();
+            if (!showPostsOnFront && path == pageForPosts) {
+                continue;
+            }
+
+            if (!showPostsOnFront && path == pageOnFront) {
+                addOutput(QStringLiteral("/"));
+            }
+            if (!path.isEmpty()) {
+                addOutput(QLatin1Char('/') + path);
+            }
+        }
+    }
+
+    query = CPreparedSqlQueryThreadForDB(
+                QStringLiteral("SELECT author_id, count(*) FROM posts "
+                               "WHERE NOT page AND published "
+                               "GROUP BY author_id"),
+                QStringLiteral("cmlyst_ro"));
+    if (Q_LIKELY(query.exec())) {
+        while (query.next()) {
+            const QString slug = engine->user(query.value(0).toInt()).value(QStringLiteral("slug"));
+            if (!slug.isEmpty()) {
+                addListing(QLatin1String("/.author/") + slug, query.value(1).toInt());
+            }
+        }
+    }
+
+    addOutput(QStringLiteral("/.feed"));
+
+    Response *res = c->res();
+    res->headers().setHeader(QStringLiteral("Cache-Control"), QStringLiteral("no-cache"));
+    res->setContentType(QStringLiteral("application/json"));
+    res->setBody(QJsonDocument(QJsonObject{
+                                   {QStringLiteral("generation"), double(generation)},
+                                   {QStringLiteral("outputs"), outputs}
+                               }).toJson(QJsonDocument::Compact));
+}
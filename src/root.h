@@ -55,6 +55,18 @@ public:
     C_ATTR(author, :Path(.author) :AutoArgs)
     void author(Cutelyst::Context *c, const QString &slug);
 
+    C_ATTR(asset, :Path(.asset) :Args)
+    void asset(Cutelyst::Context *c, const QStringList &path);
+
+    C_ATTR(media, :Path(.media) :Args)
+    void media(Cutelyst::Context *c, const QStringList &path);
+
+    C_ATTR(ready, :Path(.ready) :Args(0))
+    void ready(Cutelyst::Context *c);
+
+    C_ATTR(manifest, :Path(.manifest) :Args(0))
+    void manifest(Cutelyst::Context *c);
+
 private:
     C_ATTR(End, :ActionClass(RenderView))
     bool End(Context *c);
@@ -8,6 +8,7 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 
+#include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QSqlError>
@@ -53,23 +54,6 @@ Cutelyst::AuthenticationUser SqlUserStore::findUser(Cutelyst::Context *c, const
 
 QString SqlUserStore::addUser(const ParamsMultiMap &user, bool replace)
 {
-    QSqlQuery query;
-    if (replace) {
-        query = CPreparedSqlQueryThreadForDB(
-                    QStringLiteral("INSERT OR REPLACE INTO users "
-                                   "(slug, email, password, json) "
-                                   "VALUES "
-                                   "(:slug, :email, :password, :json)"),
-                    QStringLiteral("cmlyst"));
-    } else {
-        query = CPreparedSqlQueryThreadForDB(
-                    QStringLiteral("INSERT INTO users "
-                                   "(slug, email, password, json) "
-                                   "VALUES "
-                                   "(:slug, :email, :password, :json)"),
-                    QStringLiteral("cmlyst"));
-    }
-
     const QString name = user.value(QStringLiteral("name"));
     QString slug = name;
     if (slug.isEmpty()) {
@@ -77,6 +61,35 @@ QString SqlUserStore::addUser(const ParamsMultiMap &user, bool replace)
     }
     slug.remove(QRegularExpression(QStringLiteral("[^\\w]")));
     slug = slug.left(50).toLower().toHtmlEscaped();
+
+    // Replacing must not lose the user if adding it fails
+    QSqlDatabase db = QSqlDatabase::database(Cutelyst::Sql::databaseNameThread(QStringLiteral("cmlyst")));
+    if (!db.transaction()) {
+        qDebug() << "Failed to add new user:" << db.lastError().databaseText() << user;
+        return QString();
+    }
+
+    QSqlQuery query;
+    if (replace) {
+        query = CPreparedSqlQueryThreadForDB(
+                    QStringLiteral("DELETE FROM users "
+                                   "WHERE slug = :slug OR email = :email"),
+                    QStringLiteral("cmlyst"));
+        query.bindValue(QStringLiteral(":slug"), slug);
+        query.bindValue(QStringLiteral(":email"), user.value(QStringLiteral("email")));
+        if (!query.exec()) {
+            qDebug() << "Failed to replace user:" << query.lastError().databaseText() << user;
+            db.rollback();
+            return QString();
+        }
+    }
+
+    query = CPreparedSqlQueryThreadForDB(
+                QStringLiteral("INSERT INTO users "
+                               "(slug, email, password, json) "
+                               "VALUES "
+                               "(:slug, :email, :password, :json)"),
+                QStringLiteral("cmlyst"));
     query.bindValue(QStringLiteral(":slug"), slug);
 
     query.bindValue(QStringLiteral(":email"), user.value(QStringLiteral("email")));
@@ -87,8 +100,9 @@ QString SqlUserStore::addUser(const ParamsMultiMap &user, bool replace)
                name.left(150).toHtmlEscaped());
     query.bindValue(QStringLiteral(":json"), QString::fromUtf8(QJsonDocument(obj).toJson(QJsonDocument::Compact)));
 
-    if (!query.exec()) {
-        qDebug() << "Failed to add new user:" << query.lastError().databaseText() << user;
+    if (!query.exec() || !db.commit()) {
+        qDebug() << "Failed to add new user:" << query.lastError().databaseText() << db.lastError().databaseText() << user;
+        db.rollback();
         return QString();
     }
     return slug;
@@ -0,0 +1,285 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#include "staticexporter.h"
+#include "gzipwriter.h"
+
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QUrlQuery>
+#include <QSaveFile>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QDebug>
+
+#define STATE_FILE ".cmlyst-static.json"
+
+StaticExporter::StaticExporter(const QUrl &baseUrl, const QString &outputPath, QObject *parent) : QObject(parent)
+  , m_nam(new QNetworkAccessManager(this))
+  , m_baseUrl(baseUrl)
+  , m_output(outputPath)
+{
+
+}
+
+void StaticExporter::setFullBuild(bool enable)
+{
+    m_full = enable;
+}
+
+void StaticExporter::setCompress(bool enable)
+{
+    m_compress = enable;
+}
+
+void StaticExporter::setManifestToken(const QString &token)
+{
+    m_manifestToken = token;
+}
+
+void StaticExporter::setMaxRequests(int requests)
+{
+    m_maxRequests = qMax(1, requests);
+}
+
+int StaticExporter::written() const
+{
+    return m_written;
+}
+
+int StaticExporter::removed() const
+{
+    return m_removed;
+}
+
+int StaticExporter::failed() const
+{
+    return m_failed;
+}
+
+void StaticExporter::start()
+{
+    if (!m_output.exists() && !m_output.mkpath(m_output.absolutePath())) {
+        qWarning() << "Could not create static output directory" << m_output.absolutePath();
+        finish(false);
+        return;
+    }
+
+    QFile stateFile(m_output.absoluteFilePath(QStringLiteral(STATE_FILE)));
+    if (stateFile.open(QIODevice::ReadOnly)) {
+        m_state = QJsonDocument::fromJson(stateFile.readAll()).object();
+    }
+
+    QNetworkRequest request(siteUrl(QStringLiteral("/.manifest")));
+    if (!m_manifestToken.isEmpty()) {
+        request.setRawHeader(QByteArrayLiteral("X-Manifest-Token"), m_manifestToken.toUtf8());
+    }
+    QNetworkReply *reply = m_nam->get(request);
+    connect(reply, &QNetworkReply::finished, this, [=] {
+        manifestFinished(reply);
+    });
+}
+
+QUrl StaticExporter::siteUrl(const QString &url) const
+{
+    // Output URLs are absolute paths on the site, which may not be
+    // on the server root, resolving them would drop the base path
+    QString path = m_baseUrl.path();
+    if (!path.endsWith(QLatin1Char('/'))) {
+        path.append(QLatin1Char('/'));
+    }
+
+    const int query = url.indexOf(QLatin1Char('?'));
+    QUrl ret = m_baseUrl;
+    ret.setPath(path + url.left(query).mid(1));
+    ret.setQuery(query == -1 ? QString() : url.mid(query + 1));
+    return ret;
+}
+
+void StaticExporter::manifestFinished(QNetworkReply *reply)
+{
+    reply->deleteLater();
+    if (reply->error() != QNetworkReply::NoError) {
+        qWarning() << "Failed to get site manifest" << reply->errorString();
+        finish(false);
+        return;
+    }
+
+    const QJsonArray outputs = QJsonDocument::fromJson(reply->readAll()).object().value(QStringLiteral("outputs")).toArray();
+    for (const QJsonValue &value : outputs) {
+        const QJsonObject output = value.toObject();
+        const QString url = output.value(QStringLiteral("url")).toString();
+        const qint64 modified = qint64(output.value(QStringLiteral("modified")).toDouble());
+        if (!url.startsWith(QLatin1Char('/')) || url.contains(QLatin1String(".."))) {
+            continue;
+        }
+
+        const QJsonObject previous = m_state.value(url).toObject();
+        const QString file = previous.value(QStringLiteral("file")).toString();
+        m_modified.insert(url, modified);
+        if (m_full || file.isEmpty() ||
+                qint64(previous.value(QStringLiteral("modified")).toDouble()) != modified ||
+                !m_output.exists(file)) {
+            m_pending.append(url);
+        } else {
+            m_newState.insert(url, previous);
+        }
+    }
+
+    // Whatever is not on the manifest anymore was unpublished or removed
+    for (auto it = m_state.constBegin(); it != m_state.constEnd(); ++it) {
+        if (!m_modified.contains(it.key())) {
+            removeOutput(it.value().toObject().value(QStringLiteral("file")).toString());
+        }
+    }
+
+    qDebug() << "Static export" << m_pending.size() << "of" << m_modified.size() << "outputs changed";
+    fetchNext();
+}
+
+void StaticExporter::fetchNext()
+{
+    while (m_running < m_maxRequests && !m_pending.isEmpty()) {
+        const QString url = m_pending.takeFirst();
+        const qint64 modified = m_modified.value(url);
+
+        QNetworkReply *reply = m_nam->get(QNetworkRequest(siteUrl(url)));
+        connect(reply, &QNetworkReply::finished, this, [=] {
+            outputFinished(reply, url, modified);
+        });
+        ++m_running;
+    }
+
+    if (m_running == 0 && m_pending.isEmpty()) {
+        QSaveFile stateFile(m_output.absoluteFilePath(QStringLiteral(STATE_FILE)));
+        if (stateFile.open(QIODevice::WriteOnly)) {
+            stateFile.write(QJsonDocument(m_newState).toJson(QJsonDocument::Compact));
+            stateFile.commit();
+        }
+        finish(m_failed == 0);
+    }
+}
+
+void StaticExporter::outputFinished(QNetworkReply *reply, const QString &url, qint64 modified)
+{
+    reply->deleteLater();
+    --m_running;
+
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (reply->error() != QNetworkReply::NoError || status != 200) {
+        // Not recorded on the state so it's tried again next time
+        qWarning() << "Failed to export" << url << status << reply->errorString();
+        ++m_failed;
+    } else {
+        const QString file = outputFile(url, reply->header(QNetworkRequest::ContentTypeHeader).toByteArray());
+        if (writeFile(file, reply->readAll())) {
+            const QString previous = m_state.value(url).toObject().value(QStringLiteral("file")).toString();
+            if (!previous.isEmpty() && previous != file) {
+                removeOutput(previous);
+            }
+
+            m_newState.insert(url, QJsonObject{
+                                  {QStringLiteral("file"), file},
+                                  {QStringLiteral("modified"), double(modified)}
+                              });
+            ++m_written;
+        } else {
+            ++m_failed;
+        }
+    }
+
+    fetchNext();
+}
+
+QString StaticExporter::outputFile(const QString &url, const QByteArray &contentType) const
+{
+    const QUrl relative(url);
+    QString path = relative.path();
+    while (path.startsWith(QLatin1Char('/'))) {
+        path.remove(0, 1);
+    }
+    if (!path.isEmpty() && !path.endsWith(QLatin1Char('/'))) {
+        path.append(QLatin1Char('/'));
+    }
+
+    QString name = QStringLiteral("index");
+    const int page = QUrlQuery(relative).queryItemValue(QStringLiteral("page")).toInt();
+    if (page > 1) {
+        name.append(QLatin1Char('-') + QString::number(page));
+    }
+
+    if (contentType.contains("xml")) {
+        name.append(QLatin1String(".xml"));
+    } else {
+        name.append(QLatin1String(".html"));
+    }
+
+    return path + name;
+}
+
+bool StaticExporter::writeFile(const QString &relativePath, const QByteArray &data)
+{
+    const QString filePath = m_output.absoluteFilePath(relativePath);
+    if (!m_output.mkpath(QFileInfo(filePath).absolutePath())) {
+        qWarning() << "Could not create directory for" << filePath;
+        return false;
+    }
+
+    QSaveFile file(filePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning() << "Failed to write" << filePath << file.errorString();
+        return false;
+    }
+
+    if (m_compress) {
+        QSaveFile gzFile(filePath + QLatin1String(".gz"));
+        if (!gzFile.open(QIODevice::WriteOnly)) {
+            qWarning() << "Failed to write" << gzFile.fileName() << gzFile.errorString();
+            return false;
+        }
+
+        GzipWriter gzip(&gzFile, 9);
+        if (!gzip.write(data) || !gzip.finish() || !gzFile.commit()) {
+            qWarning() << "Failed to compress" << filePath;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void StaticExporter::removeOutput(const QString &relativePath)
+{
+    if (relativePath.isEmpty()) {
+        return;
+    }
+
+    m_output.remove(relativePath);
+    m_output.remove(relativePath + QLatin1String(".gz"));
+    ++m_removed;
+}
+
+void StaticExporter::finish(bool ok)
+{
+    qDebug() << "Static export finished, written" << m_written << "removed" << m_removed << "failed" << m_failed;
+    Q_EMIT finished(ok);
+}
@@ -0,0 +1,98 @@
+/***************************************************************************
+ *   Copyright (C) 2017 Daniel Nicoletti <dantti12@gmail.com>              *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; see the file COPYING. If not, write to       *
+ *   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,  *
+ *   Boston, MA 02110-1301, USA.                                           *
+ ***************************************************************************/
+
+#ifndef STATICEXPORTER_H
+#define STATICEXPORTER_H
+
+#include <QObject>
+#include <QUrl>
+#include <QDir>
+#include <QJsonObject>
+#include <QStringList>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+/**
+ * Renders a site to a directory by requesting every URL
+ * listed on its /.manifest, so outputs go through the same
+ * pipeline as normal requests. Outputs that didn't change
+ * since the last export are skipped unless doing a full build.
+ *
+ * Files are written as path/index.html (index-N.html for
+ * listing pages and index.xml for feeds) with a .gz copy
+ * next to them, suitable for nginx try_files and gzip_static.
+ */
+class StaticExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit StaticExporter(const QUrl &baseUrl, const QString &outputPath, QObject *parent = 0);
+
+    void setFullBuild(bool enable);
+    void setCompress(bool enable);
+
+    /**
+     * Sent to /.manifest, which only answers requests from the
+     * same host or carrying the site's ManifestToken
+     */
+    void setManifestToken(const QString &token);
+
+    /**
+     * Number of outputs requested concurrently
+     */
+    void setMaxRequests(int requests);
+
+    void start();
+
+    int written() const;
+    int removed() const;
+    int failed() const;
+
+Q_SIGNALS:
+    void finished(bool ok);
+
+private:
+    QUrl siteUrl(const QString &url) const;
+    void manifestFinished(QNetworkReply *reply);
+    void fetchNext();
+    void outputFinished(QNetworkReply *reply, const QString &url, qint64 modified);
+    QString outputFile(const QString &url, const QByteArray &contentType) const;
+    bool writeFile(const QString &relativePath, const QByteArray &data);
+    void removeOutput(const QString &relativePath);
+    void finish(bool ok);
+
+    QNetworkAccessManager *m_nam;
+    QUrl m_baseUrl;
+    QString m_manifestToken;
+    QDir m_output;
+    QJsonObject m_state;
+    QJsonObject m_newState;
+    QStringList m_pending;
+    QHash<QString, qint64> m_modified;
+    int m_maxRequests = 4;
+    int m_running = 0;
+    int m_written = 0;
+    int m_removed = 0;
+    int m_failed = 0;
+    bool m_full = false;
+    bool m_compress = true;
+};
+
+#endif // STATICEXPORTER_H